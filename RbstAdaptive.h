@@ -0,0 +1,301 @@
+#ifndef RBST_ADAPTIVE_H_INCLUDED
+#define RBST_ADAPTIVE_H_INCLUDED
+
+#include "RbstSet.h"
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#if __cplusplus >= 201103L
+#include <atomic>
+#include <mutex>
+#endif
+
+/* An RbstAdaptiveSet is an RbstSet (given by the `Set` template argument)
+   that adapts to phases of reads and writes.  While reads dominate, it keeps
+   a flat copy of its keys in Eytzinger (breadth-first) order next to the
+   tree, so that find(), count(), lower_bound(), upper_bound() and
+   equal_range() search a contiguous array whose top levels stay in cache,
+   instead of chasing pointers through the tree.  Each slot also holds the
+   index of its key, and the returned iterators are taken from an array of
+   all iterators in order, so results refer to the nodes of the tree as
+   usual.  All other operations are inherited and use the tree.
+
+   The flat array is built in O(N) time once flat_ratio() consecutive reads
+   per element have been made since the last modification, so that its cost
+   is amortized over those reads (O(1/flat_ratio()) time per read), and it
+   is dropped by the next modification.  Writes only pay for dropping it
+   once per phase.  The tree is never rebuilt, so iterators remain valid
+   across phases.
+
+   Reads may build the array, but (when compiled as C++11) this is done by
+   one thread under a lock, while other readers keep searching the tree, so
+   const methods may be called concurrently, as for RbstSet.  The set must
+   not be modified through a reference to the base class, since that would
+   bypass the flat array! */
+template<class Set>
+class RbstAdaptiveSet : public Set
+{
+public:
+    typedef typename Set::key_type          key_type;
+    typedef typename Set::value_type        value_type;
+    typedef typename Set::size_type         size_type;
+    typedef typename Set::key_compare       key_compare;
+    typedef typename Set::allocator_type    allocator_type;
+    typedef typename Set::iterator          iterator;
+    typedef typename Set::const_iterator    const_iterator;
+
+    explicit RbstAdaptiveSet( const key_compare &comp = key_compare(),
+                              const allocator_type &alloc = allocator_type() )
+        : Set(comp, alloc), m_flat(false), m_reads(0), m_flat_ratio(0.1) { }
+
+    template<class InputIterator>
+    RbstAdaptiveSet( InputIterator first, InputIterator last,
+                     const key_compare &comp = key_compare(),
+                     const allocator_type &alloc = allocator_type() )
+        : Set(comp, alloc), m_flat(false), m_reads(0), m_flat_ratio(0.1)
+    {
+        insert(first, last);
+    }
+
+    // The flat array refers to nodes, so copies build their own when needed:
+    RbstAdaptiveSet(const RbstAdaptiveSet &that)
+        : Set(that), m_flat(false), m_reads(0), m_flat_ratio(that.m_flat_ratio) { }
+
+    RbstAdaptiveSet &operator=(const RbstAdaptiveSet &that)
+    {
+        if (this != &that)
+        {
+            Set::operator=(that);
+            m_flat_ratio = that.m_flat_ratio;
+            modified();
+        }
+        return *this;
+    }
+
+    /* Returns the number of consecutive reads per element after which the
+       flat array is built; for example, with the default ratio 0.1 a set of
+       N elements builds the array after N/10 reads without modifications.
+       Building takes about as long as 0.03 N lookups in the tree, for large
+       sets of ints (see the "adaptive" benchmark in RbstBench.cpp). */
+    double flat_ratio() const { return m_flat_ratio; }
+    void set_flat_ratio(double ratio) { m_flat_ratio = ratio; }
+
+    // Returns whether reads currently use the flat array.
+    bool is_flat() const { return m_flat; }
+
+    // Modifiers, which drop the flat array:
+
+    void clear()
+    {
+        Set::clear();
+        modified();
+    }
+
+    std::pair<iterator,bool> insert(const value_type &value)
+    {
+        std::pair<iterator,bool> res = Set::insert(value);
+        if (res.second) modified();
+        return res;
+    }
+
+    iterator insert(iterator position, const value_type &value)
+    {
+        (void)position;
+        return insert(value).first;
+    }
+
+    template<class InputIterator>
+    void insert(InputIterator first, InputIterator last)
+    {
+        Set::insert(first, last);
+        modified();
+    }
+
+    template<class InputIterator>
+    void assign(InputIterator first, InputIterator last, unsigned threads = 0)
+    {
+        Set::assign(first, last, threads);
+        modified();
+    }
+
+    std::pair<iterator,bool> push_back(const value_type &value)
+    {
+        std::pair<iterator,bool> res = Set::push_back(value);
+        if (res.second) modified();
+        return res;
+    }
+
+    template<class InputIterator>
+    void append(InputIterator first, InputIterator last, unsigned threads = 0)
+    {
+        Set::append(first, last, threads);
+        modified();
+    }
+
+    void erase(iterator pos)
+    {
+        Set::erase(pos);
+        modified();
+    }
+
+    void erase(iterator first, iterator last)
+    {
+        Set::erase(first, last);
+        modified();
+    }
+
+    size_type erase(const key_type &key)
+    {
+        size_type res = Set::erase(key);
+        if (res) modified();
+        return res;
+    }
+
+    std::pair<iterator,bool> replace(iterator pos, const value_type &value)
+    {
+        modified();
+        return Set::replace(pos, value);
+    }
+
+    void swap(RbstAdaptiveSet &that)
+    {
+        Set::swap(that);
+        std::swap(m_flat_ratio, that.m_flat_ratio);
+        modified();
+        that.modified();
+    }
+
+    // Lookups, which use the flat array if it is built:
+
+    size_type count(const key_type &key) const
+    {
+        if (!flat()) return Set::count(key);
+        size_type slot = search(key, false);
+        return slot < m_keys.size() && !this->key_comp()(key, m_keys[slot]);
+    }
+
+    const_iterator find(const key_type &key) const
+    {
+        if (!flat()) return Set::find(key);
+        size_type slot = search(key, false);
+        return slot < m_keys.size() && !this->key_comp()(key, m_keys[slot])
+            ? iterator_at(slot) : this->end();
+    }
+
+    const_iterator lower_bound(const key_type &key) const
+    {
+        if (!flat()) return Set::lower_bound(key);
+        return iterator_at(search(key, false));
+    }
+
+    const_iterator upper_bound(const key_type &key) const
+    {
+        if (!flat()) return Set::upper_bound(key);
+        return iterator_at(search(key, true));
+    }
+
+    std::pair<const_iterator,const_iterator> equal_range(const key_type &key) const
+    {
+        if (!flat()) return Set::equal_range(key);
+        return std::make_pair( iterator_at(search(key, false)),
+                               iterator_at(search(key, true)) );
+    }
+
+protected:
+    // Records a read, builds the flat array when it is due, and returns
+    // whether the flat array can be used.
+    bool flat() const
+    {
+        if (is_flat()) return true;
+        if (++m_reads < m_flat_ratio*this->size() || this->empty()) return false;
+#if __cplusplus >= 201103L
+        // Only one thread builds the array; the others keep using the tree:
+        std::unique_lock<std::mutex> lock(m_mutex, std::try_to_lock);
+        if (!lock.owns_lock()) return false;
+#endif
+        if (!m_flat)
+        {
+            build();
+            m_flat = true;
+        }
+        return true;
+    }
+
+    // Drops the flat array, and restarts counting reads.
+    void modified()
+    {
+        m_flat = false;
+        m_keys.clear();
+        m_indices.clear();
+        m_iterators.clear();
+        m_reads = 0;
+    }
+
+    // Builds the flat array from the tree, in O(N) time.
+    void build() const
+    {
+        size_type n = this->size();
+        m_iterators.clear();
+        m_iterators.reserve(n);
+        for (const_iterator it = this->begin(); it != this->end(); ++it)
+            m_iterators.push_back(it);
+        m_keys.resize(n, *this->begin());
+        m_indices.resize(n);
+        fill(0, 0);
+    }
+
+    // Fills the Eytzinger subtree at `slot` with the keys from index `i` on,
+    // and returns the index after them.
+    size_type fill(size_type slot, size_type i) const
+    {
+        if (slot >= m_keys.size()) return i;
+        i = fill(2*slot + 1, i);
+        m_keys[slot] = *m_iterators[i];
+        m_indices[slot] = i;
+        return fill(2*slot + 2, i + 1);
+    }
+
+    /* Returns the slot of the first key not less than `key` (if `upper` is
+       false) or greater than `key` (if `upper` is true), or size() if there
+       is none.  The children of slot i are slots 2i + 1 and 2i + 2, so the
+       16 descendants four levels down, which are prefetched (where the
+       compiler supports it), start at slot 16i + 15. */
+    size_type search(const key_type &key, bool upper) const
+    {
+        const key_compare &comp = this->key_comp();
+        const key_type *keys = m_keys.empty() ? NULL : &m_keys[0];
+        size_type n = m_keys.size(), slot = 0, res = n;
+        while (slot < n)
+        {
+#ifdef __GNUC__
+            if (16*slot + 15 < n) __builtin_prefetch(keys + 16*slot + 15);
+#endif
+            bool right = upper ? !comp(key, keys[slot]) : comp(keys[slot], key);
+            if (!right) res = slot;
+            slot = 2*slot + 1 + right;
+        }
+        return res;
+    }
+
+    // Returns the iterator for the key in `slot`, or end() if slot >= size().
+    const_iterator iterator_at(size_type slot) const
+    {
+        return slot < m_keys.size() ? m_iterators[m_indices[slot]] : this->end();
+    }
+
+    mutable std::vector<key_type>       m_keys;         // in Eytzinger order
+    mutable std::vector<size_type>      m_indices;      // index of each slot's key
+    mutable std::vector<const_iterator> m_iterators;    // in order
+#if __cplusplus >= 201103L
+    mutable std::atomic<bool>           m_flat;         // set once the array is built
+    mutable std::atomic<size_type>      m_reads;
+    mutable std::mutex                  m_mutex;        // held while building
+#else
+    mutable bool                        m_flat;
+    mutable size_type                   m_reads;
+#endif
+    double                              m_flat_ratio;
+};
+
+#endif  /* ndef RBST_ADAPTIVE_H_INCLUDED */
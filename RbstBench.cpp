@@ -0,0 +1,1568 @@
+// Benchmarks for RbstSet.
+//
+// Usage: RbstBench [<benchmark>...] [<option>=<value>...]
+//
+// Runs the named benchmarks, or all benchmarks if none are given.  Options
+// configure the workload driver (the "workload" benchmark).
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#if __cplusplus >= 201103L
+#include <mutex>
+#endif
+
+#include "RbstNode.h"
+#include "RbstAdaptive.h"
+#include "RbstBoundedSet.h"
+#include "RbstCheck.h"
+#include "RbstCountedMultiset.h"
+#include "RbstFilter.h"
+#include "RbstHash.h"
+#include "RbstHashIndex.h"
+#include "RbstRangeCount.h"
+#include "RbstRangeSet.h"
+#include "RbstRope.h"
+#include "RbstSet.h"
+#include "RbstVersioned.h"
+
+
+// Returns the current time in seconds, from an arbitrary starting point.
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+// Prints latency percentiles of the given samples (in seconds) in nanoseconds.
+static void report_latency(const char *name, std::vector<double> &samples)
+{
+    std::sort(samples.begin(), samples.end());
+    double total = 0;
+    for (size_t i = 0; i < samples.size(); ++i) total += samples[i];
+    const double percentiles[] = { 50, 99, 99.9, 99.99 };
+    printf("  %-24s mean %7.0f", name, 1e9*total/samples.size());
+    for (size_t i = 0; i < sizeof(percentiles)/sizeof(*percentiles); ++i)
+    {
+        size_t j = (size_t)(percentiles[i]/100*(samples.size() - 1));
+        printf("  p%-5g %7.0f", percentiles[i], 1e9*samples[j]);
+    }
+    printf("  max %7.0f ns\n", 1e9*samples.back());
+}
+
+// Generates `n` distinct keys in random order.
+static std::vector<int> random_keys(size_t n)
+{
+    std::vector<int> keys(n);
+    for (size_t i = 0; i < n; ++i) keys[i] = (int)(2*i);
+    std::random_shuffle(keys.begin(), keys.end());
+    return keys;
+}
+
+/* Measures per-operation latency of insert(), find() and erase() on a set
+   of type `Set`, inserting the given keys in order. */
+template<class Set>
+static void bench_latency_set(const char *name, const std::vector<int> &keys)
+{
+    std::vector<double> insert_times, find_times, erase_times;
+    insert_times.reserve(keys.size());
+    find_times.reserve(keys.size());
+    erase_times.reserve(keys.size());
+
+    Set set;
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        double t = now();
+        set.insert(keys[i]);
+        insert_times.push_back(now() - t);
+    }
+    size_t depth = rbst_max_depth(set.debug_tree().root()), found = 0;
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        double t = now();
+        found += set.find(keys[keys.size() - 1 - i]) != set.end();
+        find_times.push_back(now() - t);
+    }
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        double t = now();
+        set.erase(keys[i]);
+        erase_times.push_back(now() - t);
+    }
+
+    printf("%s (max depth %d, found %d):\n", name, (int)depth, (int)found);
+    report_latency("insert", insert_times);
+    report_latency("find", find_times);
+    report_latency("erase", erase_times);
+}
+
+// Compares tail latency of randomized and weight-balanced trees.
+static void bench_latency()
+{
+    typedef RbstSet<int> random_set;
+    typedef RbstSet< int, std::less<int>, std::allocator<int>,
+                     RbstWeightBalanced > balanced_set;
+
+    const size_t n = 1000000;
+    std::vector<int> keys = random_keys(n);
+    bench_latency_set<random_set>("randomized, random keys", keys);
+    bench_latency_set<balanced_set>("weight-balanced, random keys", keys);
+    std::sort(keys.begin(), keys.end());
+    bench_latency_set<random_set>("randomized, sorted keys", keys);
+    bench_latency_set<balanced_set>("weight-balanced, sorted keys", keys);
+}
+
+// Compares descending scans using std::reverse_iterator and native iterators.
+static void bench_reverse()
+{
+    const size_t n = 1000000;
+    std::vector<int> keys = random_keys(n);
+    RbstSet<int> set(keys.begin(), keys.end());
+
+    typedef std::reverse_iterator<RbstSet<int>::const_iterator> std_reverse_iterator;
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        long long sum = 0;
+        double t = now();
+        if (pass == 0)
+        {
+            for ( std_reverse_iterator it(set.end()), end(set.begin());
+                  it != end; ++it ) sum += *it;
+        }
+        else
+        {
+            for ( RbstSet<int>::const_reverse_iterator it = set.rbegin();
+                  it != set.rend(); ++it ) sum += *it;
+        }
+        t = now() - t;
+        printf( "  %-24s %7.2f ns/element (sum %lld)\n",
+                pass == 0 ? "std::reverse_iterator" : "const_reverse_iterator",
+                1e9*t/n, sum );
+    }
+}
+
+// Compares range scans with lower_bound()/upper_bound() and range views.
+static void bench_range()
+{
+    const size_t n = 1000000, queries = 100000;
+    std::vector<int> keys = random_keys(n);
+    RbstSet<int> set(keys.begin(), keys.end());
+
+    const int widths[] = { 1, 10, 100, 1000 };
+    for (size_t w = 0; w < sizeof(widths)/sizeof(*widths); ++w)
+    {
+        srand(1);
+        long long sum1 = 0, sum2 = 0;
+        double t1 = now();
+        for (size_t q = 0; q < queries; ++q)
+        {
+            int lo = rand()%(2*n), hi = lo + 2*widths[w];
+            RbstSet<int>::const_iterator it = set.lower_bound(lo),
+                                         end = set.lower_bound(hi);
+            for (; it != end; ++it) sum1 += *it;
+        }
+        t1 = now() - t1;
+        srand(1);
+        double t2 = now();
+        for (size_t q = 0; q < queries; ++q)
+        {
+            int lo = rand()%(2*n), hi = lo + 2*widths[w];
+            RbstSetRange<int> range = set.range(lo, hi);
+            for ( RbstSetRange<int>::const_iterator it = range.begin();
+                  it != range.end(); ++it ) sum2 += *it;
+        }
+        t2 = now() - t2;
+        printf( "  width %5d: lower_bound %7.0f ns/query, range %7.0f ns/query%s\n",
+                widths[w], 1e9*t1/queries, 1e9*t2/queries,
+                sum1 == sum2 ? "" : " (MISMATCH!)" );
+    }
+}
+
+// Measures the cost of `it += k` for a sweep of offsets k.
+static void bench_offset()
+{
+    const size_t n = 1000000, steps = 1000000;
+    std::vector<int> keys = random_keys(n);
+    RbstSet<int> set(keys.begin(), keys.end());
+
+    const int offsets[] = { 1, 2, 3, 4, 5, 6, 8, 12, 16, 32, 64, 1024 };
+    for (size_t k = 0; k < sizeof(offsets)/sizeof(*offsets); ++k)
+    {
+        const ptrdiff_t d = offsets[k];
+        RbstSet<int>::const_iterator it = set.begin();
+        ptrdiff_t i = 0;
+        long long sum = 0;
+        double t = now();
+        for (size_t s = 0; s < steps; ++s)
+        {
+            if (i + d >= (ptrdiff_t)n) it = set.begin(), i = 0;
+            it += d;
+            i += d;
+            sum += *it;
+        }
+        t = now() - t;
+        printf("  it += %-5d %7.1f ns (sum %lld)\n", (int)d, 1e9*t/steps, sum);
+    }
+}
+
+// Measures the cost of comparing equal sets (the worst case).
+static void bench_compare()
+{
+    const size_t n = 1000000;
+    std::vector<int> keys = random_keys(n);
+    RbstSet<int> a(keys.begin(), keys.end()), b(keys.begin(), keys.end());
+
+    double t = now();
+    bool equal = std::equal(a.begin(), a.end(), b.begin());
+    printf("  std::equal  %7.2f ns/element (%d)\n", 1e9*(now() - t)/n, (int)equal);
+    t = now();
+    equal = a == b;
+    printf("  operator==  %7.2f ns/element (%d)\n", 1e9*(now() - t)/n, (int)equal);
+    t = now();
+    bool less = std::lexicographical_compare(a.begin(), a.end(), b.begin(), b.end());
+    printf("  std::lexicographical_compare %7.2f ns/element (%d)\n", 1e9*(now() - t)/n, (int)less);
+    t = now();
+    less = a < b;
+    printf("  operator<   %7.2f ns/element (%d)\n", 1e9*(now() - t)/n, (int)less);
+}
+
+// Measures throughput of exporting a set to an array.
+static void bench_export()
+{
+    const size_t n = 10000000;
+    std::vector<int> keys = random_keys(n);
+    RbstSet<int> set(keys.begin(), keys.end());
+    std::vector<int> output(n);
+
+    double t = now();
+    std::copy(set.begin(), set.end(), output.begin());
+    t = now() - t;
+    printf("  iterators     %7.3f s  %7.3f GB/s\n", t, n*sizeof(int)/t/1e9);
+    for (unsigned threads = 1; threads <= rbst_hardware_threads(); threads *= 2)
+    {
+        t = now();
+        set.copy_to(output.begin(), threads);
+        t = now() - t;
+        printf("  %2d thread(s)  %7.3f s  %7.3f GB/s\n", threads, t, n*sizeof(int)/t/1e9);
+    }
+}
+
+// Compares incremental insertion and bulk construction from unsorted keys.
+static void bench_build()
+{
+    const size_t n = 10000000;
+    std::vector<int> keys(n);
+    for (size_t i = 0; i < n; ++i) keys[i] = rand();
+
+    double t = now();
+    {
+        RbstSet<int> set;
+        for (size_t i = 0; i < n; ++i) set.insert(keys[i]);
+        printf("  insert()      %7.3f s\n", now() - t);
+    }
+    for (unsigned threads = 1; threads <= rbst_hardware_threads(); threads *= 2)
+    {
+        t = now();
+        RbstSet<int> set;
+        set.assign(keys.begin(), keys.end(), threads);
+        printf("  assign() with %2d thread(s) %7.3f s\n", threads, now() - t);
+    }
+}
+
+/* Compares rbst_sort() (radix sort) with std::sort() on random 32-bit and
+   64-bit keys, for 10M keys and up to RBST_BENCH_MAX_KEYS (default: 100M). */
+template<class T>
+static void bench_radix_type(const char *name, size_t n)
+{
+    std::vector<T> keys(n);
+    for (size_t i = 0; i < n; ++i)
+        keys[i] = (T)(((uint64_t)rand() << 32) ^ ((uint64_t)rand() << 16) ^ rand());
+    std::vector<T> copy = keys;
+
+    double t = now();
+    std::sort(copy.begin(), copy.end());
+    double t1 = now() - t;
+    copy = keys;
+    t = now();
+    rbst_sort(&copy[0], &copy[0] + n, std::less<T>(), rbst_hardware_threads());
+    double t2 = now() - t;
+    printf( "  %-8s %10lu keys: std::sort %7.3f s, rbst_sort %7.3f s (%.1fx)\n",
+            name, (unsigned long)n, t1, t2, t1/t2 );
+}
+
+static void bench_radix()
+{
+    const char *env = getenv("RBST_BENCH_MAX_KEYS");
+    size_t max_keys = env ? strtoul(env, NULL, 10) : 100000000;
+    for (size_t n = 10000000; n <= max_keys; n *= 10)
+    {
+        bench_radix_type<int32_t>("int32_t", n);
+        bench_radix_type<int64_t>("int64_t", n);
+        bench_radix_type<double>("double", n);
+    }
+}
+
+// Compares looking up percentiles one by one and with at_many().
+static void bench_at_many()
+{
+    const size_t n = 1000000, rounds = 1000;
+    std::vector<int> keys = random_keys(n);
+    RbstSet<int> set(keys.begin(), keys.end());
+
+    const size_t counts[] = { 10, 100, 1000 };
+    for (size_t c = 0; c < sizeof(counts)/sizeof(*counts); ++c)
+    {
+        const size_t k = counts[c];
+        std::vector<size_t> indices;
+        for (size_t i = 0; i < k; ++i) indices.push_back(i*n/k);
+        std::vector<RbstSet<int>::const_iterator> its(k);
+        long long sum1 = 0, sum2 = 0;
+
+        double t1 = now();
+        for (size_t r = 0; r < rounds; ++r)
+            for (size_t i = 0; i < k; ++i) sum1 += set.begin()[indices[i]];
+        t1 = now() - t1;
+        double t2 = now();
+        for (size_t r = 0; r < rounds; ++r)
+        {
+            set.at_many(indices.begin(), indices.end(), its.begin());
+            for (size_t i = 0; i < k; ++i) sum2 += *its[i];
+        }
+        t2 = now() - t2;
+        printf( "  %4d ranks: one by one %8.0f ns, at_many() %8.0f ns%s\n",
+                (int)k, 1e9*t1/rounds, 1e9*t2/rounds, sum1 == sum2 ? "" : " (MISMATCH!)" );
+    }
+}
+
+// Compares computing ranks one by one and with rank_many().
+static void bench_rank_many()
+{
+    const size_t n = 1000000, rounds = 1000;
+    std::vector<int> keys = random_keys(n);
+    RbstSet<int> set(keys.begin(), keys.end());
+
+    const size_t counts[] = { 10, 100, 1000 };
+    for (size_t c = 0; c < sizeof(counts)/sizeof(*counts); ++c)
+    {
+        const size_t k = counts[c];
+        std::vector<int> queries;
+        for (size_t i = 0; i < k; ++i) queries.push_back(rand()%(2*n));
+        std::sort(queries.begin(), queries.end());
+        std::vector<size_t> ranks(k);
+        long long sum1 = 0, sum2 = 0;
+
+        double t1 = now();
+        for (size_t r = 0; r < rounds; ++r)
+            for (size_t i = 0; i < k; ++i) sum1 += set.lower_bound(queries[i]) - set.begin();
+        t1 = now() - t1;
+        double t2 = now();
+        for (size_t r = 0; r < rounds; ++r)
+        {
+            set.rank_many(queries.begin(), queries.end(), ranks.begin());
+            for (size_t i = 0; i < k; ++i) sum2 += ranks[i];
+        }
+        t2 = now() - t2;
+        printf( "  %4d keys: one by one %8.0f ns, rank_many() %8.0f ns%s\n",
+                (int)k, 1e9*t1/rounds, 1e9*t2/rounds, sum1 == sum2 ? "" : " (MISMATCH!)" );
+    }
+}
+
+/* Compares computing intersection sizes by looking up each element of the
+   smaller set in the larger one, and with intersection_size(). */
+static void bench_intersection()
+{
+    const size_t n = 1000000, rounds = 10;
+    std::vector<int> keys = random_keys(n);
+    RbstSet<int> large(keys.begin(), keys.end());
+
+    const size_t sizes[] = { 1000, 100000, 1000000 };
+    for (size_t s = 0; s < sizeof(sizes)/sizeof(*sizes); ++s)
+    {
+        // Half of the elements of the smaller set are in the larger one:
+        const size_t m = sizes[s];
+        RbstSet<int> small;
+        for (size_t i = 0; i < m; ++i) small.insert(keys[i] + (int)(i%2));
+        size_t count1 = 0, count2 = 0;
+
+        double t1 = now();
+        for (size_t r = 0; r < rounds; ++r)
+            for (RbstSet<int>::const_iterator it = small.begin(); it != small.end(); ++it)
+                count1 += large.count(*it);
+        t1 = now() - t1;
+        double t2 = now();
+        for (size_t r = 0; r < rounds; ++r) count2 += intersection_size(small, large);
+        t2 = now() - t2;
+        printf( "  %7d x %7d: lookups %10.0f us, intersection_size() %10.0f us%s\n",
+                (int)m, (int)n, 1e6*t1/rounds, 1e6*t2/rounds, count1 == count2 ? "" : " (MISMATCH!)" );
+    }
+}
+
+/* Compares finding the differences between two replicas of a set with
+   hashed nodes using diff(), and by a merge of both sets in order.  Also
+   measures the cost of maintaining the hashes on insertion. */
+static void bench_diff()
+{
+    typedef RbstSet< int, std::less<int>, std::allocator<int>, DefaultRng,
+                     RbstHashedNode<int> > HashedSet;
+    const size_t n = 1000000;
+    std::vector<int> keys = random_keys(n);
+
+    double t1 = now();
+    RbstSet<int> plain;
+    for (size_t i = 0; i < n; ++i) plain.insert(keys[i]);
+    t1 = now() - t1;
+    double t2 = now();
+    HashedSet a;
+    for (size_t i = 0; i < n; ++i) a.insert(keys[i]);
+    t2 = now() - t2;
+    printf( "  insert %d keys: plain %6.0f ms, hashed %6.0f ms\n",
+            (int)n, 1e3*t1, 1e3*t2 );
+
+    HashedSet b(a);
+    const size_t counts[] = { 0, 1, 10, 100, 1000, 10000 };
+    for (size_t c = 0, changed = 0; c < sizeof(counts)/sizeof(*counts); ++c)
+    {
+        // Add odd keys (not in `a`) to `b` until `counts[c]` differ:
+        for (; changed < counts[c]; ++changed) b.insert(2*(rand()%(int)n) + 1);
+        changed = b.size() - a.size();
+        std::vector<int> only_a, only_b;
+
+        double t1 = now();
+        std::set_difference( a.begin(), a.end(), b.begin(), b.end(),
+                             std::back_inserter(only_a) );
+        std::set_difference( b.begin(), b.end(), a.begin(), a.end(),
+                             std::back_inserter(only_b) );
+        t1 = now() - t1;
+        size_t found1 = only_a.size() + only_b.size();
+        only_a.clear();
+        only_b.clear();
+        double t2 = now();
+        a.diff(b, std::back_inserter(only_a), std::back_inserter(only_b));
+        t2 = now() - t2;
+        size_t found2 = only_a.size() + only_b.size();
+        printf( "  %5d differences: merge %9.0f us, diff() %9.0f us%s\n",
+                (int)changed, 1e6*t1, 1e6*t2, found1 == found2 ? "" : " (MISMATCH!)" );
+    }
+}
+
+// Returns queries for the keys 0, 2, .., 2(n - 1) with the given hit ratio.
+static std::vector<int> find_queries(size_t n, double hit_ratio)
+{
+    std::vector<int> keys(1000000);
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        int key = 2*(rand()%(int)n);
+        keys[i] = (rand() < hit_ratio*RAND_MAX) ? key : key + 1;
+    }
+    return keys;
+}
+
+// Measures the mean time of find() for the given queries, and adds the
+// number of keys found to `found`.
+template<class Set>
+static double time_find(const Set &set, const std::vector<int> &keys, size_t &found)
+{
+    double t = now();
+    for (size_t i = 0; i < keys.size(); ++i) found += set.find(keys[i]) != set.end();
+    t = now() - t;
+    return t/keys.size();
+}
+
+// Compares find() with and without a counting filter, for various hit ratios.
+static void bench_filter()
+{
+    const size_t n = 1000000;
+    std::vector<int> keys = random_keys(n);
+    RbstSet<int> plain(keys.begin(), keys.end());
+    RbstFilteredSet<RbstSet<int> > filtered(keys.begin(), keys.end());
+
+    const double ratios[] = { 0, 0.1, 0.5, 0.9, 1 };
+    for (size_t i = 0; i < sizeof(ratios)/sizeof(*ratios); ++i)
+    {
+        std::vector<int> queries = find_queries(n, ratios[i]);
+        size_t found1 = 0, found2 = 0;
+        double t1 = time_find(plain, queries, found1), t2 = time_find(filtered, queries, found2);
+        printf( "  %3.0f%% hits: plain %5.0f ns, filtered %5.0f ns, %7lu found%s\n",
+                100*ratios[i], 1e9*t1, 1e9*t2, (unsigned long)found1,
+                found1 == found2 ? "" : " (MISMATCH!)" );
+    }
+}
+
+// Compares find(), insert() and erase() with and without a hash index.
+static void bench_hash_index()
+{
+    const size_t n = 1000000;
+    std::vector<int> keys = random_keys(n);
+
+    double t1 = now();
+    RbstSet<int> plain;
+    for (size_t i = 0; i < n; ++i) plain.insert(keys[i]);
+    t1 = now() - t1;
+    double t2 = now();
+    RbstHashIndexedSet<RbstSet<int> > indexed;
+    for (size_t i = 0; i < n; ++i) indexed.insert(keys[i]);
+    t2 = now() - t2;
+    printf("  insert: plain %5.0f ns, indexed %5.0f ns\n", 1e9*t1/n, 1e9*t2/n);
+
+    const double ratios[] = { 0, 0.5, 1 };
+    for (size_t i = 0; i < sizeof(ratios)/sizeof(*ratios); ++i)
+    {
+        std::vector<int> queries = find_queries(n, ratios[i]);
+        size_t found1 = 0, found2 = 0;
+        double t1 = time_find(plain, queries, found1), t2 = time_find(indexed, queries, found2);
+        printf( "  find, %3.0f%% hits: plain %5.0f ns, indexed %5.0f ns, %7lu found%s\n",
+                100*ratios[i], 1e9*t1, 1e9*t2, (unsigned long)found1,
+                found1 == found2 ? "" : " (MISMATCH!)" );
+    }
+
+    t1 = now();
+    for (size_t i = 0; i < n; ++i) plain.erase(keys[i]);
+    t1 = now() - t1;
+    t2 = now();
+    for (size_t i = 0; i < n; ++i) indexed.erase(keys[i]);
+    t2 = now() - t2;
+    printf("  erase: plain %5.0f ns, indexed %5.0f ns\n", 1e9*t1/n, 1e9*t2/n);
+}
+
+/* Compares keeping the least N of a stream of keys with an RbstSet (erasing
+   the greatest element after each insertion that overflows) and with an
+   RbstBoundedSet, one by one and in batches. */
+static void bench_bounded()
+{
+    const size_t n = 1000000, batch = 10000;
+    std::vector<int> keys(n);
+    for (size_t i = 0; i < n; ++i) keys[i] = rand();
+
+    const size_t capacities[] = { 100, 10000 };
+    for (size_t c = 0; c < sizeof(capacities)/sizeof(*capacities); ++c)
+    {
+        const size_t capacity = capacities[c];
+        double t1 = now();
+        RbstSet<int> plain;
+        for (size_t i = 0; i < n; ++i)
+        {
+            plain.insert(keys[i]);
+            if (plain.size() > capacity) plain.erase(--plain.end());
+        }
+        t1 = now() - t1;
+        double t2 = now();
+        RbstBoundedSet<RbstSet<int> > bounded(capacity);
+        for (size_t i = 0; i < n; ++i) bounded.insert(keys[i]);
+        t2 = now() - t2;
+        double t3 = now();
+        RbstBoundedSet<RbstSet<int> > batched(capacity);
+        for (size_t i = 0; i < n; i += batch)
+            batched.insert(keys.begin() + i, keys.begin() + i + batch);
+        t3 = now() - t3;
+        printf( "  N=%5d: insert+erase %4.0f ns, bounded %4.0f ns, batches of %d %4.0f ns%s\n",
+                (int)capacity, 1e9*t1/n, 1e9*t2/n, (int)batch, 1e9*t3/n,
+                plain == bounded && plain == batched ? "" : " (MISMATCH!)" );
+    }
+
+    // Erasing a range:
+    std::vector<int> values = random_keys(n);
+    RbstSet<int> a(values.begin(), values.end()), b(a);
+    double t1 = now();
+    for (RbstSet<int>::iterator it = a.begin() + n/2; it != a.end(); ) a.erase(it++);
+    t1 = now() - t1;
+    double t2 = now();
+    b.erase(b.begin() + n/2, b.end());
+    t2 = now() - t2;
+    printf( "  erase %d of %d elements: one by one %4.0f ms, range %4.0f ms%s\n",
+            (int)(n/2), (int)n, 1e3*t1, 1e3*t2, a == b ? "" : " (MISMATCH!)" );
+}
+
+/* Compares an RbstSet<int> and an RbstRangeSet<int> holding IDs in [0, n)
+   (inserted in random order) of which a fraction is missing, by memory used
+   for the nodes, and time per insertion and lookup. */
+static void bench_range_set()
+{
+    typedef RbstWeightedNode<std::pair<int,int>, RbstRunWeight<int> > RunNode;
+    const size_t n = 1000000;
+    std::vector<int> ids = random_keys(n);
+    for (size_t i = 0; i < n; ++i) ids[i] /= 2;
+
+    const size_t gaps[] = { 0, 1000, 100000 };
+    for (size_t g = 0; g < sizeof(gaps)/sizeof(*gaps); ++g)
+    {
+        std::vector<int> present;
+        for (size_t i = 0; i < n; ++i)
+            if (rand()%n >= gaps[g]) present.push_back(ids[i]);
+
+        double t1 = now();
+        RbstSet<int> plain;
+        for (size_t i = 0; i < present.size(); ++i) plain.insert(present[i]);
+        t1 = now() - t1;
+        double t2 = now();
+        RbstRangeSet<int> runs;
+        for (size_t i = 0; i < present.size(); ++i) runs.insert(present[i]);
+        t2 = now() - t2;
+
+        size_t found1 = 0, found2 = 0;
+        double t3 = now();
+        for (size_t i = 0; i < n; ++i) found1 += plain.count(ids[i]);
+        t3 = now() - t3;
+        double t4 = now();
+        for (size_t i = 0; i < n; ++i) found2 += runs.count(ids[i]);
+        t4 = now() - t4;
+
+        printf( "  %6d missing: RbstSet %6.1f MB, insert %4.0f ns, count %4.0f ns; "
+                "RbstRangeSet %6.3f MB (%d runs), insert %4.0f ns, count %4.0f ns%s\n",
+                (int)(n - present.size()),
+                plain.size()*sizeof(RbstValuedNode<int>)/1e6, 1e9*t1/n, 1e9*t3/n,
+                runs.run_count()*sizeof(RunNode)/1e6, (int)runs.run_count(), 1e9*t2/n, 1e9*t4/n,
+                found1 == found2 && plain.size() == runs.size() ? "" : " (MISMATCH!)" );
+    }
+}
+
+/* Compares an RbstSet<int> of (key, occurrence) pairs with an
+   RbstCountedMultiset<int>, for a Zipf-like histogram of a few thousand
+   distinct keys, by memory used for the nodes, time per insertion and time
+   per access by index. */
+static void bench_counted()
+{
+    typedef RbstWeightedNode<std::pair<int,size_t>, RbstEntryWeight<int> > EntryNode;
+    const size_t n = 1000000, distinct = 5000;
+    std::vector<int> keys(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        double r = (double)rand()/RAND_MAX;
+        keys[i] = (int)((distinct - 1)*r*r*r*r);
+    }
+
+    double t1 = now();
+    RbstSet<std::pair<int,size_t> > plain;
+    for (size_t i = 0; i < n; ++i) plain.insert(std::make_pair(keys[i], i));
+    t1 = now() - t1;
+    double t2 = now();
+    RbstCountedMultiset<int> counted;
+    for (size_t i = 0; i < n; ++i) counted.insert(keys[i]);
+    t2 = now() - t2;
+
+    long sum1 = 0, sum2 = 0;
+    double t3 = now();
+    for (size_t i = 0; i < n; ++i) sum1 += plain.begin()[keys[i]*(n/distinct)].first;
+    t3 = now() - t3;
+    double t4 = now();
+    for (size_t i = 0; i < n; ++i) sum2 += counted.at(keys[i]*(n/distinct));
+    t4 = now() - t4;
+
+    printf( "  RbstSet %6.1f MB, insert %4.0f ns, at %4.0f ns; "
+            "RbstCountedMultiset %6.3f MB (%d keys), insert %4.0f ns, at %4.0f ns%s\n",
+            plain.size()*sizeof(RbstValuedNode<std::pair<int,size_t> >)/1e6, 1e9*t1/n, 1e9*t3/n,
+            counted.distinct_size()*sizeof(EntryNode)/1e6, (int)counted.distinct_size(),
+            1e9*t2/n, 1e9*t4/n, sum1 == sum2 ? "" : " (MISMATCH!)" );
+}
+
+/* Score updates: moves random elements of a set by a small or a random amount,
+   using replace() compared with erase() followed by insert(). */
+static void bench_replace()
+{
+    const size_t n = 1000000, k = 1000000;
+    std::vector<int> keys = random_keys(n);
+    const int spreads[] = { 16, 1 << 20, RAND_MAX };
+    for (size_t s = 0; s < sizeof(spreads)/sizeof(*spreads); ++s)
+    {
+        const int spread = spreads[s];
+        RbstSet<int> a(keys.begin(), keys.end()), b(a);
+        std::vector<int> moves(k);
+        for (size_t i = 0; i < k; ++i) moves[i] = rand()%spread - spread/2;
+
+        double t1 = now();
+        for (size_t i = 0; i < k; ++i)
+        {
+            RbstSet<int>::iterator it = a.begin() + i%a.size();
+            int value = *it + moves[i];
+            a.erase(it);
+            a.insert(value);
+        }
+        t1 = now() - t1;
+        double t2 = now();
+        for (size_t i = 0; i < k; ++i)
+        {
+            RbstSet<int>::iterator it = b.begin() + i%b.size();
+            b.replace(it, *it + moves[i]);
+        }
+        t2 = now() - t2;
+
+        printf( "  spread %10d: erase+insert %4.0f ns, replace %4.0f ns%s\n",
+                spread, 1e9*t1/k, 1e9*t2/k, a == b ? "" : " (MISMATCH!)" );
+    }
+}
+
+/* Ingest of increasing keys (such as timestamps): insert() compared with
+   push_back() per key, and append() per batch of 1000 keys. */
+static void bench_append()
+{
+    const size_t n = 1000000, batch = 1000;
+    std::vector<int> keys(n);
+    for (size_t i = 0; i < n; ++i) keys[i] = (int)(3*i + rand()%3);
+
+    double t1 = now();
+    RbstSet<int> a;
+    for (size_t i = 0; i < n; ++i) a.insert(keys[i]);
+    t1 = now() - t1;
+    double t2 = now();
+    RbstSet<int> b;
+    for (size_t i = 0; i < n; ++i) b.push_back(keys[i]);
+    t2 = now() - t2;
+    double t3 = now();
+    RbstSet<int> c;
+    for (size_t i = 0; i < n; i += batch) c.append(keys.begin() + i, keys.begin() + i + batch, 1);
+    t3 = now() - t3;
+
+    printf( "  insert %4.0f ns, push_back %4.0f ns, append %4.0f ns per key%s\n",
+            1e9*t1/n, 1e9*t2/n, 1e9*t3/n, a == b && b == c ? "" : " (MISMATCH!)" );
+}
+
+/* Checkpoints of a set with 100000 keys, with 1000 random changes between
+   checkpoints: a full RbstSet copy per checkpoint compared with a single
+   RbstVersionedSet, by the number of nodes and the time per rank query at a
+   random checkpoint, with and without collecting all but the last 10. */
+static void bench_versioned()
+{
+    const size_t n = 100000, changes = 1000, checkpoints = 100, queries = 100000;
+    std::vector<int> keys = random_keys(2*n);
+    RbstSet<int> current(keys.begin(), keys.begin() + n);
+    RbstVersionedSet<int> versioned;
+    for (size_t i = 0; i < n; ++i) versioned.insert(keys[i]);
+    std::vector<RbstSet<int> > copies;
+    for (size_t c = 0; c < checkpoints; ++c)
+    {
+        for (size_t i = 0; i < changes; ++i)
+        {
+            int key = keys[rand()%keys.size()];
+            if (current.erase(key)) versioned.erase(key);
+            else if (current.insert(key).second) versioned.insert(key);
+        }
+        copies.push_back(current);
+        versioned.commit();
+    }
+
+    for (int collected = 0; collected < 2; ++collected)
+    {
+        size_t first = collected ? checkpoints - 10 : 0;
+        if (collected)
+        {
+            versioned.collect(first);
+            copies.erase(copies.begin(), copies.begin() + first);
+        }
+        size_t copy_nodes = 0;
+        for (size_t c = 0; c < copies.size(); ++c) copy_nodes += copies[c].size();
+
+        std::vector<size_t> versions(queries);
+        std::vector<int> probes(queries);
+        for (size_t i = 0; i < queries; ++i)
+        {
+            versions[i] = rand()%copies.size();
+            probes[i] = keys[rand()%keys.size()];
+        }
+        size_t sum1 = 0, sum2 = 0;
+        double t1 = now();
+        for (size_t i = 0; i < queries; ++i)
+        {
+            const RbstSet<int> &copy = copies[versions[i]];
+            sum1 += copy.size() + (copy.lower_bound(probes[i]) - copy.end());
+        }
+        t1 = now() - t1;
+        double t2 = now();
+        for (size_t i = 0; i < queries; ++i)
+            sum2 += versioned.rank(probes[i], first + versions[i]);
+        t2 = now() - t2;
+
+        printf( "  %3d checkpoints: copies %8d nodes, rank %5.0f ns; "
+                "versioned %7d nodes, rank %5.0f ns%s\n",
+                (int)copies.size(), (int)copy_nodes, 1e9*t1/queries,
+                (int)versioned.node_count(), 1e9*t2/queries,
+                sum1 == sum2 ? "" : " (MISMATCH!)" );
+    }
+}
+
+/* Counts events with a time in [t1, t2] and a value <= v, by scanning the
+   time range of an RbstSet of (time, value) pairs, and with an
+   RbstRangeCounter; also compares the time to build and update both. */
+static void bench_range_count()
+{
+    const size_t n = 200000, queries = 10000, updates = 100000;
+    std::vector<std::pair<int,int> > events(n);
+    for (size_t i = 0; i < n; ++i) events[i] = std::make_pair(rand()%(int)n, rand()%1000);
+
+    double t1 = now();
+    RbstSet<std::pair<int,int> > plain(events.begin(), events.end());
+    t1 = now() - t1;
+    double t2 = now();
+    RbstRangeCounter<int,int> counter(events.begin(), events.end());
+    t2 = now() - t2;
+
+    const int widths[] = { 100, 10000, (int)n };
+    for (size_t w = 0; w < sizeof(widths)/sizeof(*widths); ++w)
+    {
+        std::vector<int> starts(queries), limits(queries);
+        for (size_t i = 0; i < queries; ++i)
+        {
+            starts[i] = rand()%((int)n - widths[w] + 1);
+            limits[i] = rand()%1000;
+        }
+        size_t sum1 = 0, sum2 = 0;
+        double t3 = now();
+        for (size_t i = 0; i < queries; ++i)
+        {
+            RbstSet<std::pair<int,int> >::const_iterator
+                it = plain.lower_bound(std::make_pair(starts[i], -1)),
+                end = plain.lower_bound(std::make_pair(starts[i] + widths[w], -1));
+            for (; it != end; ++it) sum1 += it->second <= limits[i];
+        }
+        t3 = now() - t3;
+        double t4 = now();
+        for (size_t i = 0; i < queries; ++i)
+            sum2 += counter.count_below(starts[i], starts[i] + widths[w] - 1, limits[i]);
+        t4 = now() - t4;
+        printf( "  width %6d: scan %9.0f ns, RbstRangeCounter %6.0f ns%s\n",
+                widths[w], 1e9*t3/queries, 1e9*t4/queries, sum1 == sum2 ? "" : " (MISMATCH!)" );
+    }
+
+    double t5 = now();
+    for (size_t i = 0; i < updates; ++i)
+    {
+        const std::pair<int,int> &e = events[rand()%n];
+        if (!counter.erase(e.first, e.second)) counter.insert(e.first, e.second);
+    }
+    t5 = now() - t5;
+    printf( "  build: RbstSet %.0f ms, RbstRangeCounter %.0f ms; update %.0f ns\n",
+            1e3*t1, 1e3*t2, 1e9*t5/updates );
+}
+
+/* Sorts 1M iterators into a set of 1M ints by position, comparing them with
+   operator< (which compares indices) and with the set's iterator_comp(). */
+static void bench_iterator_order()
+{
+    const size_t n = 1000000;
+    std::vector<int> keys = random_keys(n);
+    RbstSet<int> set(keys.begin(), keys.end());
+    std::vector<RbstSet<int>::iterator> its;
+    for (size_t i = 0; i < n; ++i) its.push_back(set.find(keys[i]));
+    std::vector<RbstSet<int>::iterator> a(its), b(its);
+
+    double t1 = now();
+    std::sort(a.begin(), a.end());
+    t1 = now() - t1;
+    double t2 = now();
+    std::sort(b.begin(), b.end(), set.iterator_comp());
+    t2 = now() - t2;
+    printf( "  sort by operator< %.0f ms, by iterator_comp() %.0f ms%s\n",
+            1e3*t1, 1e3*t2, a == b ? "" : " (MISMATCH!)" );
+}
+
+/* Makes small random edits (typing and deleting a few bytes) and large ones
+   (pasting and cutting 64 KB) in a 16 MB text held in a std::string and in
+   an RbstRope, and times line lookups and a full scan of the rope. */
+static void bench_rope()
+{
+    const size_t n = 16 << 20, edits = 1000, lookups = 100000;
+    std::string text(n, 'x');
+    for (size_t i = 0; i < n; i += 1 + rand()%120) text[i] = '\n';
+    RbstRope<> rope;
+    rope.append(text);
+    const std::string paste(64 << 10, 'y');
+
+    for (int large = 0; large < 2; ++large)
+    {
+        std::vector<size_t> offsets(edits);
+        for (size_t i = 0; i < edits; ++i) offsets[i] = rand()%(n - paste.size());
+        double t1 = now();
+        for (size_t i = 0; i < edits; ++i)
+        {
+            if (large) text.insert(offsets[i], paste), text.erase(offsets[edits - 1 - i], paste.size());
+            else text.insert(offsets[i], "abc", 3), text.erase(offsets[edits - 1 - i], 3);
+        }
+        t1 = now() - t1;
+        double t2 = now();
+        for (size_t i = 0; i < edits; ++i)
+        {
+            if (large) rope.insert(offsets[i], paste), rope.erase(offsets[edits - 1 - i], paste.size());
+            else rope.insert(offsets[i], "abc", 3), rope.erase(offsets[edits - 1 - i], 3);
+        }
+        t2 = now() - t2;
+        printf( "  %s edits: std::string %8.0f ns, RbstRope %6.0f ns (%d chunks)%s\n",
+                large ? "64 KB" : "3 B  ", 1e9*t1/(2*edits), 1e9*t2/(2*edits),
+                (int)rope.chunk_count(), rope.substr(0) == text ? "" : " (MISMATCH!)" );
+    }
+
+    size_t sum = 0;
+    double t3 = now();
+    for (size_t i = 0; i < lookups; ++i)
+        sum += rope.line_start(rand()%rope.line_count());
+    t3 = now() - t3;
+    double t4 = now();
+    size_t newlines = 0;
+    for (RbstRope<>::chunk_iterator it = rope.chunk_begin(); it != rope.chunk_end(); ++it)
+        newlines += std::count(it->begin(), it->end(), '\n');
+    t4 = now() - t4;
+    printf( "  line_start %.0f ns; scan %.1f GB/s%s\n", 1e9*t3/lookups,
+            rope.size()/t4*1e-9, newlines + 1 == rope.line_count() && sum ? "" : " (MISMATCH!)" );
+}
+
+// Runs `phases` phases of `reads` lookups followed by `writes` updates.
+template<class Set>
+static double run_phases( Set &set, const std::vector<int> &keys, size_t phases,
+                          size_t reads, size_t writes, size_t &sum )
+{
+    double t = now();
+    size_t k = 0;
+    for (size_t p = 0; p < phases; ++p)
+    {
+        for (size_t i = 0; i < reads; ++i, ++k)
+            sum += set.lower_bound(keys[k%keys.size()]) != set.end();
+        for (size_t i = 0; i < writes; ++i, ++k)
+        {
+            int key = keys[k%keys.size()];
+            if (!set.erase(key)) set.insert(key);
+        }
+    }
+    return now() - t;
+}
+
+/* Runs traces that alternate between phases of lookups and phases of updates
+   on a set of 1M ints, with an RbstSet and with an RbstAdaptiveSet. */
+static void bench_adaptive()
+{
+    const size_t n = 1000000;
+    std::vector<int> keys = random_keys(2*n), probes(keys);
+    for (size_t i = probes.size(); i > 1; --i) std::swap(probes[i - 1], probes[rand()%i]);
+    const size_t traces[][3] = { { 4, 4000000, 1000 }, { 40, 400000, 1000 },
+                                 { 1000, 1000, 1000 }, { 4, 0, 500000 } };
+    for (size_t t = 0; t < sizeof(traces)/sizeof(*traces); ++t)
+    {
+        size_t phases = traces[t][0], reads = traces[t][1], writes = traces[t][2];
+        RbstSet<int> plain(keys.begin(), keys.begin() + n);
+        RbstAdaptiveSet<RbstSet<int> > adaptive(keys.begin(), keys.begin() + n);
+        size_t sum1 = 0, sum2 = 0;
+        double t1 = run_phases(plain, probes, phases, reads, writes, sum1);
+        double t2 = run_phases(adaptive, probes, phases, reads, writes, sum2);
+        size_t ops = phases*(reads + writes);
+        printf( "  %4d x (%7d reads, %6d writes): RbstSet %5.0f ns/op, RbstAdaptiveSet %5.0f ns/op%s\n",
+                (int)phases, (int)reads, (int)writes, 1e9*t1/ops, 1e9*t2/ops,
+                sum1 == sum2 && plain.size() == adaptive.size() ? "" : " (MISMATCH!)" );
+    }
+}
+
+/* Workload driver, in the style of YCSB: runs a stream of operations with a
+   configurable key distribution and operation mix on an RbstSet<int>, a
+   std::set<int> and a sorted std::vector<int>, and reports the throughput and
+   latency percentiles of each.  Options are given as name=value arguments:
+
+     dist=uniform|zipfian|sequential|hot   key distribution (default zipfian)
+     mix=a|b|c|d|e|f|<op>:<weight>,...     operation mix (default b)
+     size=N        number of keys loaded before the run (default 100000)
+     ops=N         number of operations (default 200000)
+     threads=N     number of client threads (default 1)
+     scan=N        number of keys covered by a scan (default 100)
+     seed=N        seed of the workload (default 1)
+     record=FILE   record the operations seen by an instrumented RbstSet
+     replay=FILE   replay a recorded trace instead of generating one
+
+   For example: RbstBench workload dist=hot mix=find:90,rank:10 threads=4.
+   Without options, a standard set of workloads is run.  The operations are
+   insert, erase, find, rank (the index of lower_bound(key)), scan (visiting
+   the keys in [key, key + scan)) and at (the element at an index). */
+
+enum WorkloadOpType { OP_INSERT, OP_ERASE, OP_FIND, OP_RANK, OP_SCAN, OP_AT, OP_TYPES };
+
+static const char *const workload_op_names[OP_TYPES] =
+    { "insert", "erase", "find", "rank", "scan", "at" };
+
+// An operation on a key; `arg` is the length of a scan, or the index for at
+// (modulo the size of the set).
+struct WorkloadOp
+{
+    int type, key;
+    size_t arg;
+};
+
+// Random number generator for workloads (SplitMix64), which unlike rand()
+// yields the same sequence everywhere for a given seed.
+struct WorkloadRng
+{
+    WorkloadRng(uint64_t seed) : state(seed) { }
+    uint64_t next() { return rbst_mix_hash(state += 0x9e3779b97f4a7c15ULL); }
+    size_t below(size_t n) { return (size_t)(next()%n); }
+    double uniform() { return (next() >> 11)*(1.0/9007199254740992.0); }
+    uint64_t state;
+};
+
+/* Chooses key indices in [0, n) according to a distribution:
+   - uniform: all indices are equally likely;
+   - zipfian: index i has the i-th highest probability, proportional to
+     1/i^0.99, computed as in YCSB (Gray et al., "Quickly generating
+     billion-record synthetic databases"), and scattered over [0, n) by
+     hashing, so that the popular keys are not adjacent;
+   - sequential: the indices 0, 1, 2, ... in order (wrapping around);
+   - hot: 90% of the indices fall in a range of 10% of the keys. */
+class WorkloadKeys
+{
+public:
+    WorkloadKeys(const std::string &dist, size_t n, WorkloadRng &rng)
+        : m_dist(dist), m_n(n), m_next(0), m_hot(rng.below(n - n/10))
+    {
+        if (m_dist != "zipfian") return;
+        const double theta = 0.99;
+        m_zetan = 0;
+        for (size_t i = 1; i <= n; ++i) m_zetan += 1/pow((double)i, theta);
+        m_alpha = 1/(1 - theta);
+        m_eta = (1 - pow(2.0/n, 1 - theta))/(1 - (1 + pow(0.5, theta))/m_zetan);
+        m_half = pow(0.5, theta);
+    }
+
+    // Returns whether `dist` names a distribution.
+    static bool valid(const std::string &dist)
+    {
+        return dist == "uniform" || dist == "zipfian" || dist == "sequential" || dist == "hot";
+    }
+
+    size_t next(WorkloadRng &rng)
+    {
+        if (m_dist == "sequential") return m_next++%m_n;
+        if (m_dist == "hot")
+            return rng.below(10) < 9 ? m_hot + rng.below(m_n/10 + 1) : rng.below(m_n);
+        if (m_dist != "zipfian") return rng.below(m_n);
+        double u = rng.uniform(), uz = u*m_zetan;
+        size_t rank = uz < 1 ? 0 : uz < 1 + m_half ? 1
+                    : std::min((size_t)(m_n*pow(m_eta*u - m_eta + 1, m_alpha)), m_n - 1);
+        return (size_t)(rbst_mix_hash(rank)%m_n);
+    }
+
+private:
+    std::string m_dist;
+    size_t m_n, m_next, m_hot;
+    double m_zetan, m_alpha, m_eta, m_half;
+};
+
+// Parses an operation mix into weights per operation type, or returns false.
+static bool parse_workload_mix(const std::string &mix, int weights[OP_TYPES])
+{
+    static const char *const presets[][2] = {
+        { "a", "find:50,insert:25,erase:25" },  // update heavy
+        { "b", "find:95,insert:3,erase:2" },    // read mostly
+        { "c", "find:100" },                    // read only
+        { "d", "find:95,insert:5" },            // growing (use dist=sequential)
+        { "e", "scan:95,insert:5" },            // short ranges
+        { "f", "rank:45,at:45,insert:5,erase:5" } };    // positional
+    std::string spec = mix;
+    for (size_t i = 0; i < sizeof(presets)/sizeof(*presets); ++i)
+        if (mix == presets[i][0]) spec = presets[i][1];
+
+    std::fill(weights, weights + OP_TYPES, 0);
+    int total = 0;
+    for (size_t pos = 0; pos < spec.size(); )
+    {
+        size_t end = spec.find(',', pos), colon = spec.find(':', pos);
+        if (end == std::string::npos) end = spec.size();
+        if (colon >= end) return false;
+        std::string name = spec.substr(pos, colon - pos);
+        int type = 0;
+        while (type < OP_TYPES && name != workload_op_names[type]) ++type;
+        if (type == OP_TYPES) return false;
+        weights[type] += atoi(spec.substr(colon + 1, end - colon - 1).c_str());
+        total += weights[type];
+        pos = end + 1;
+    }
+    return total > 0;
+}
+
+/* Generates `count` operations on a set loaded with the keys 0, 2, ...,
+   2*(size - 1).  Lookups and scans start at loaded keys, while updates
+   insert and erase the odd keys next to them, so that the set stays near its
+   loaded size when inserts and erases are balanced. */
+static std::vector<WorkloadOp> generate_workload( const std::string &dist,
+    const int weights[OP_TYPES], size_t size, size_t count, size_t scan, uint64_t seed )
+{
+    WorkloadRng rng(seed);
+    WorkloadKeys keys(dist, size, rng);
+    int total = 0;
+    for (int i = 0; i < OP_TYPES; ++i) total += weights[i];
+    std::vector<WorkloadOp> ops(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        int pick = (int)rng.below(total), type = 0;
+        while (pick >= weights[type]) pick -= weights[type++];
+        size_t index = keys.next(rng);
+        WorkloadOp op = { type, (int)(2*index), 0 };
+        if (type == OP_INSERT || type == OP_ERASE) op.key += 1;
+        if (type == OP_SCAN) op.arg = scan;
+        if (type == OP_AT) op.arg = (size_t)rng.next();
+        ops[i] = op;
+    }
+    return ops;
+}
+
+// Writes a trace as text, one operation per line, after a header line with
+// the number of keys loaded.  Returns whether this succeeded.
+static bool write_trace(const char *path, size_t size, const std::vector<WorkloadOp> &ops)
+{
+    FILE *fp = fopen(path, "w");
+    if (!fp) return false;
+    fprintf(fp, "size %lu\n", (unsigned long)size);
+    for (size_t i = 0; i < ops.size(); ++i)
+        fprintf( fp, "%s %d %lu\n", workload_op_names[ops[i].type],
+                 ops[i].key, (unsigned long)ops[i].arg );
+    return fclose(fp) == 0;
+}
+
+// Reads a trace written by write_trace().  Returns whether this succeeded.
+static bool read_trace(const char *path, size_t &size, std::vector<WorkloadOp> &ops)
+{
+    FILE *fp = fopen(path, "r");
+    if (!fp) return false;
+    unsigned long n = 0, arg = 0;
+    bool ok = fscanf(fp, "size %lu\n", &n) == 1;
+    size = n;
+    char name[16];
+    WorkloadOp op;
+    while (ok && fscanf(fp, "%15s %d %lu\n", name, &op.key, &arg) == 3)
+    {
+        op.type = 0;
+        while (op.type < OP_TYPES && strcmp(name, workload_op_names[op.type]) != 0) ++op.type;
+        ok = op.type < OP_TYPES;
+        op.arg = arg;
+        ops.push_back(op);
+    }
+    ok = ok && feof(fp);
+    fclose(fp);
+    return ok;
+}
+
+/* An RbstSet (given by the `Set` template argument) that records the
+   operations made on it as a trace: insert(), erase(key), find() and
+   count() (as finds), lower_bound() (as a rank query, since it is the same
+   descent), range(lo, hi) (as a scan) and at(i).  Accesses through
+   iterators, such as begin()[i], are not recorded. */
+template<class Set>
+class RbstRecordingSet : public Set
+{
+public:
+    typedef typename Set::key_type          key_type;
+    typedef typename Set::value_type        value_type;
+    typedef typename Set::size_type         size_type;
+    typedef typename Set::iterator          iterator;
+    typedef typename Set::const_iterator    const_iterator;
+
+    const std::vector<WorkloadOp> &trace() const { return m_trace; }
+
+    std::pair<iterator,bool> insert(const value_type &value)
+    {
+        record(OP_INSERT, value);
+        return Set::insert(value);
+    }
+
+    size_type erase(const key_type &key)
+    {
+        record(OP_ERASE, key);
+        return Set::erase(key);
+    }
+
+    const_iterator find(const key_type &key) const
+    {
+        record(OP_FIND, key);
+        return Set::find(key);
+    }
+
+    size_type count(const key_type &key) const
+    {
+        record(OP_FIND, key);
+        return Set::count(key);
+    }
+
+    const_iterator lower_bound(const key_type &key) const
+    {
+        record(OP_RANK, key);
+        return Set::lower_bound(key);
+    }
+
+    RbstSetRange<key_type> range(const key_type &lo, const key_type &hi) const
+    {
+        record(OP_SCAN, lo, (size_t)(hi - lo));
+        return Set::range(lo, hi);
+    }
+
+    // Returns the element at index i (which must be less than size()).
+    const value_type &at(size_type i) const
+    {
+        record(OP_AT, 0, i);
+        return this->begin()[i];
+    }
+
+protected:
+    void record(int type, const key_type &key, size_t arg = 0) const
+    {
+        WorkloadOp op = { type, key, arg };
+        m_trace.push_back(op);
+    }
+
+    mutable std::vector<WorkloadOp> m_trace;
+};
+
+// Returns the element at index i of an RbstSet, through at() if the set is
+// an RbstRecordingSet, so that the access is recorded.
+template<class Set>
+static int workload_at(const Set &set, size_t i) { return set.begin()[i]; }
+
+template<class Set>
+static int workload_at(const RbstRecordingSet<Set> &set, size_t i) { return set.at(i); }
+
+// Workload operations on an RbstSet (or a subclass, such as RbstRecordingSet).
+template<class Set>
+struct RbstSetWorkload
+{
+    static const bool indexed = true;
+
+    void load(const std::vector<int> &keys) { set.assign(keys.begin(), keys.end()); }
+    size_t size() const { return set.size(); }
+
+    bool insert(int key) { return set.insert(key).second; }
+    bool erase(int key)  { return set.erase(key) > 0; }
+    bool find(int key) const { return set.count(key) > 0; }
+    size_t rank(int key) const { return set.lower_bound(key) - set.begin(); }
+    int at(size_t i) const { return workload_at(set, i); }
+
+    size_t scan(int key, size_t n) const
+    {
+        RbstSetRange<int> range = set.range(key, key + (int)n);
+        size_t sum = 0;
+        for (RbstSetRange<int>::iterator it = range.begin(); it != range.end(); ++it) sum += *it;
+        return sum;
+    }
+
+    Set set;
+};
+
+// Workload operations on a std::set, whose rank and at take O(N) time.
+struct StdSetWorkload
+{
+    static const bool indexed = false;
+
+    void load(const std::vector<int> &keys) { set = std::set<int>(keys.begin(), keys.end()); }
+    size_t size() const { return set.size(); }
+
+    bool insert(int key) { return set.insert(key).second; }
+    bool erase(int key)  { return set.erase(key) > 0; }
+    bool find(int key) const { return set.count(key) > 0; }
+    size_t rank(int key) const { return std::distance(set.begin(), set.lower_bound(key)); }
+
+    int at(size_t i) const
+    {
+        std::set<int>::const_iterator it = set.begin();
+        std::advance(it, i);
+        return *it;
+    }
+
+    size_t scan(int key, size_t n) const
+    {
+        size_t sum = 0;
+        for ( std::set<int>::const_iterator it = set.lower_bound(key);
+              it != set.end() && *it < key + (int)n; ++it ) sum += *it;
+        return sum;
+    }
+
+    std::set<int> set;
+};
+
+// Workload operations on a sorted vector, whose updates take O(N) time.
+struct SortedVectorWorkload
+{
+    static const bool indexed = true;
+
+    void load(const std::vector<int> &keys) { vec = keys; }
+    size_t size() const { return vec.size(); }
+
+    bool insert(int key)
+    {
+        std::vector<int>::iterator it = std::lower_bound(vec.begin(), vec.end(), key);
+        if (it != vec.end() && *it == key) return false;
+        vec.insert(it, key);
+        return true;
+    }
+
+    bool erase(int key)
+    {
+        std::vector<int>::iterator it = std::lower_bound(vec.begin(), vec.end(), key);
+        if (it == vec.end() || *it != key) return false;
+        vec.erase(it);
+        return true;
+    }
+
+    bool find(int key) const { return std::binary_search(vec.begin(), vec.end(), key); }
+    size_t rank(int key) const { return std::lower_bound(vec.begin(), vec.end(), key) - vec.begin(); }
+    int at(size_t i) const { return vec[i]; }
+
+    size_t scan(int key, size_t n) const
+    {
+        size_t sum = 0;
+        for ( std::vector<int>::const_iterator it = std::lower_bound(vec.begin(), vec.end(), key);
+              it != vec.end() && *it < key + (int)n; ++it ) sum += *it;
+        return sum;
+    }
+
+    std::vector<int> vec;
+};
+
+#if __cplusplus >= 201103L
+typedef std::mutex WorkloadMutex;
+#else
+struct WorkloadMutex { void lock() { } void unlock() { } };
+#endif
+
+/* Runs a slice of a trace per client thread.  With several threads and any
+   updates in the trace, every operation holds a single lock, as a shared
+   container without internal synchronization would require. */
+template<class Workload>
+struct WorkloadTask
+{
+    WorkloadTask( Workload &workload, const std::vector<WorkloadOp> &ops,
+                  unsigned threads, bool locked )
+        : workload(workload), ops(ops), threads(threads), locked(locked),
+          samples(threads), sums(threads) { }
+
+    void operator()(size_t t)
+    {
+        size_t first = ops.size()*t/threads, last = ops.size()*(t + 1)/threads;
+        samples[t].reserve(last - first);
+        for (size_t i = first; i < last; ++i)
+        {
+            double start = now();
+            if (locked) mutex.lock();
+            sums[t] += execute(ops[i]);
+            if (locked) mutex.unlock();
+            samples[t].push_back(now() - start);
+        }
+    }
+
+    size_t execute(const WorkloadOp &op)
+    {
+        switch (op.type)
+        {
+        case OP_INSERT: return workload.insert(op.key);
+        case OP_ERASE:  return workload.erase(op.key);
+        case OP_FIND:   return workload.find(op.key);
+        case OP_RANK:   return workload.rank(op.key);
+        case OP_SCAN:   return workload.scan(op.key, op.arg);
+        default:        return workload.size() ? workload.at(op.arg%workload.size()) : 0;
+        }
+    }
+
+    Workload &workload;
+    const std::vector<WorkloadOp> &ops;
+    unsigned threads;
+    bool locked;
+    WorkloadMutex mutex;
+    std::vector<std::vector<double> > samples;
+    std::vector<size_t> sums;
+};
+
+/* Loads `workload` with `size` keys, runs the trace with `threads` threads,
+   and reports the throughput and latency percentiles.  Stores a checksum of
+   the results, which is deterministic for a single thread, in `sum`.
+   Returns false if the trace was skipped, since the container does not
+   support positional operations efficiently. */
+template<class Workload>
+static bool run_workload( const char *name, Workload &workload, size_t size,
+                          const std::vector<WorkloadOp> &ops, unsigned threads,
+                          size_t &sum )
+{
+    bool updates = false, positional = false;
+    for (size_t i = 0; i < ops.size(); ++i)
+    {
+        updates = updates || ops[i].type == OP_INSERT || ops[i].type == OP_ERASE;
+        positional = positional || ops[i].type == OP_RANK || ops[i].type == OP_AT;
+    }
+    if (positional && !Workload::indexed)
+    {
+        printf("  %-24s skipped (rank and at take O(N) time)\n", name);
+        return false;
+    }
+
+    std::vector<int> keys(size);
+    for (size_t i = 0; i < size; ++i) keys[i] = (int)(2*i);
+    workload.load(keys);
+    WorkloadTask<Workload> task(workload, ops, threads, threads > 1 && updates);
+    double t = now();
+    rbst_parallel_for(threads, threads, task);
+    t = now() - t;
+
+    std::vector<double> samples;
+    sum = 0;
+    for (unsigned i = 0; i < threads; ++i)
+    {
+        samples.insert(samples.end(), task.samples[i].begin(), task.samples[i].end());
+        sum += task.sums[i];
+    }
+    printf("  %-24s %7.3f Mop/s\n", name, ops.size()/t*1e-6);
+    report_latency("latency", samples);
+    return true;
+}
+
+// Runs a trace on all containers, and checks that the results agree.
+static void run_workloads( const char *title, size_t size,
+                           const std::vector<WorkloadOp> &ops, unsigned threads )
+{
+    printf("%s, %lu keys, %lu ops, %u thread(s):\n", title, (unsigned long)size,
+           (unsigned long)ops.size(), threads);
+    RbstSetWorkload<RbstSet<int> > rbst;
+    StdSetWorkload stdset;
+    SortedVectorWorkload vec;
+    size_t sum1 = 0, sum2 = 0, sum3 = 0;
+    run_workload("RbstSet", rbst, size, ops, threads, sum1);
+    bool ran = run_workload("std::set", stdset, size, ops, threads, sum2);
+    run_workload("sorted vector", vec, size, ops, threads, sum3);
+    if (threads == 1 && (sum1 != sum3 || (ran && sum1 != sum2)))
+        printf("  (MISMATCH!)\n");
+}
+
+// Options given as name=value arguments (see the workload driver).
+static std::vector<std::string> bench_options;
+
+static std::string workload_option(const char *name, const char *default_value)
+{
+    std::string prefix = std::string(name) + "=";
+    for (size_t i = 0; i < bench_options.size(); ++i)
+        if (bench_options[i].compare(0, prefix.size(), prefix) == 0)
+            return bench_options[i].substr(prefix.size());
+    return default_value;
+}
+
+static void bench_workload()
+{
+    std::string dist = workload_option("dist", "zipfian"), mix = workload_option("mix", "b"),
+                record = workload_option("record", ""), replay = workload_option("replay", "");
+    size_t size = (size_t)atol(workload_option("size", "100000").c_str()),
+           count = (size_t)atol(workload_option("ops", "200000").c_str()),
+           scan = (size_t)atol(workload_option("scan", "100").c_str());
+    unsigned threads = (unsigned)atoi(workload_option("threads", "1").c_str());
+    uint64_t seed = (uint64_t)atol(workload_option("seed", "1").c_str());
+    int weights[OP_TYPES];
+    if (!WorkloadKeys::valid(dist) || !parse_workload_mix(mix, weights) || size == 0 || threads == 0)
+    {
+        printf("  invalid workload options\n");
+        return;
+    }
+
+    std::vector<WorkloadOp> ops;
+    if (!replay.empty())
+    {
+        if (!read_trace(replay.c_str(), size, ops))
+        {
+            printf("  cannot read trace %s\n", replay.c_str());
+            return;
+        }
+        run_workloads(("replay " + replay).c_str(), size, ops, threads);
+        return;
+    }
+    if (!record.empty())
+    {
+        // Run the workload on an instrumented set, and replay what it saw:
+        RbstSetWorkload<RbstRecordingSet<RbstSet<int> > > recording;
+        size_t sum = 0;
+        run_workload( "RbstRecordingSet", recording, size,
+                      generate_workload(dist, weights, size, count, scan, seed), 1, sum );
+        if (recording.set.trace().size() != count)
+            printf("  recorded %lu ops (MISMATCH!)\n", (unsigned long)recording.set.trace().size());
+        if (!write_trace(record.c_str(), size, recording.set.trace()))
+        {
+            printf("  cannot write trace %s\n", record.c_str());
+            return;
+        }
+        run_workloads(("record " + record).c_str(), size, recording.set.trace(), threads);
+        return;
+    }
+    if (!bench_options.empty())
+    {
+        run_workloads( ("mix " + mix + ", " + dist).c_str(), size,
+                       generate_workload(dist, weights, size, count, scan, seed), threads );
+        return;
+    }
+
+    // Without options: each mix with Zipfian keys, the read-mostly mix with
+    // each distribution, and the read-only mix with several threads.
+    const char *const mixes[] = { "a", "b", "c", "e", "f" },
+                      *const dists[] = { "uniform", "sequential", "hot" };
+    for (size_t i = 0; i < sizeof(mixes)/sizeof(*mixes); ++i)
+    {
+        parse_workload_mix(mixes[i], weights);
+        run_workloads( (std::string("mix ") + mixes[i] + ", zipfian").c_str(), size,
+                       generate_workload("zipfian", weights, size, count, scan, seed), 1 );
+    }
+    parse_workload_mix("b", weights);
+    for (size_t i = 0; i < sizeof(dists)/sizeof(*dists); ++i)
+        run_workloads( (std::string("mix b, ") + dists[i]).c_str(), size,
+                       generate_workload(dists[i], weights, size, count, scan, seed), 1 );
+    parse_workload_mix("c", weights);
+    ops = generate_workload("zipfian", weights, size, count, scan, seed);
+    for (unsigned t = 2; t <= std::min(rbst_hardware_threads(), 8u); t *= 2)
+        run_workloads("mix c, zipfian", size, ops, t);
+}
+
+struct Benchmark
+{
+    const char *name;
+    void (*run)();
+};
+
+static const Benchmark benchmarks[] = {
+    { "latency", bench_latency },
+    { "reverse", bench_reverse },
+    { "range",   bench_range },
+    { "offset",  bench_offset },
+    { "compare", bench_compare },
+    { "export",  bench_export },
+    { "build",   bench_build },
+    { "radix",   bench_radix },
+    { "at_many", bench_at_many },
+    { "rank_many", bench_rank_many },
+    { "intersection", bench_intersection },
+    { "diff",    bench_diff },
+    { "filter",  bench_filter },
+    { "hash_index", bench_hash_index },
+    { "bounded", bench_bounded },
+    { "range_set", bench_range_set },
+    { "counted", bench_counted },
+    { "replace", bench_replace },
+    { "append",  bench_append },
+    { "versioned", bench_versioned },
+    { "range_count", bench_range_count },
+    { "iterator_order", bench_iterator_order },
+    { "rope",    bench_rope },
+    { "adaptive", bench_adaptive },
+    { "workload", bench_workload },
+};
+
+int main(int argc, char *argv[])
+{
+    const size_t count = sizeof(benchmarks)/sizeof(*benchmarks);
+    int names = 0;
+    for (int j = 1; j < argc; ++j)
+    {
+        if (strchr(argv[j], '='))
+            bench_options.push_back(argv[j]);
+        else
+            ++names;
+    }
+    for (size_t i = 0; i < count; ++i)
+    {
+        bool selected = names == 0;
+        for (int j = 1; j < argc; ++j)
+            if (strcmp(argv[j], benchmarks[i].name) == 0) selected = true;
+        if (!selected) continue;
+        printf("=== %s ===\n", benchmarks[i].name);
+        benchmarks[i].run();
+    }
+}
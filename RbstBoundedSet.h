@@ -0,0 +1,210 @@
+#ifndef RBST_BOUNDED_SET_H_INCLUDED
+#define RBST_BOUNDED_SET_H_INCLUDED
+
+#include "RbstSet.h"
+#include <cstddef>
+#include <utility>
+
+/* An RbstBoundedSet is an RbstSet (given by the `Set` template argument) that
+   keeps only its `capacity()` least elements, as ordered by the comparator;
+   for example, the top N entries of a leaderboard.
+
+   The greatest element is cached, so that a candidate that would be evicted
+   immediately is rejected with a single comparison.  When an admitted
+   element overflows the set, the cached greatest element is erased directly,
+   without searching for it.  Batches of elements are admitted by inserting
+   them and then dropping the overflow with a range erase, which splits the
+   tree in O(log N) time.
+
+   The set must not be modified through a reference to the base class, since
+   that would bypass the size bound! */
+template<class Set>
+class RbstBoundedSet : public Set
+{
+public:
+    typedef typename Set::key_type          key_type;
+    typedef typename Set::value_type        value_type;
+    typedef typename Set::size_type         size_type;
+    typedef typename Set::key_compare       key_compare;
+    typedef typename Set::allocator_type    allocator_type;
+    typedef typename Set::iterator          iterator;
+    typedef typename Set::const_iterator    const_iterator;
+
+    explicit RbstBoundedSet( size_type capacity,
+                             const key_compare &comp = key_compare(),
+                             const allocator_type &alloc = allocator_type() )
+        : Set(comp, alloc), m_capacity(capacity), m_max(this->end()) { }
+
+    template<class InputIterator>
+    RbstBoundedSet( size_type capacity, InputIterator first, InputIterator last,
+                    const key_compare &comp = key_compare(),
+                    const allocator_type &alloc = allocator_type() )
+        : Set(comp, alloc), m_capacity(capacity), m_max(this->end())
+    {
+        insert(first, last);
+    }
+
+    // The cached maximum refers to a node, so it is looked up for copies:
+    RbstBoundedSet(const RbstBoundedSet &that)
+        : Set(that), m_capacity(that.m_capacity), m_max(greatest()) { }
+
+    RbstBoundedSet &operator=(const RbstBoundedSet &that)
+    {
+        if (this != &that)
+        {
+            Set::operator=(that);
+            m_capacity = that.m_capacity;
+            m_max = greatest();
+        }
+        return *this;
+    }
+
+    size_type capacity() const { return m_capacity; }
+
+    // Returns an iterator to the greatest element, or end() if empty.
+    const_iterator max() const { return m_max; }
+
+    void clear()
+    {
+        Set::clear();
+        m_max = this->end();
+    }
+
+    /* Inserts `value` if it is among the capacity() least elements, evicting
+       the greatest element if the set is full.  Returns an iterator to the
+       element and whether it was inserted, or end() and false if the value
+       was rejected (and is not already present). */
+    std::pair<iterator,bool> insert(const value_type &value)
+    {
+        const key_compare &comp = this->key_comp();
+        if (this->size() >= m_capacity &&
+            (m_capacity == 0 || !comp(value, *m_max)))
+        {
+            bool present = m_capacity > 0 && !comp(*m_max, value);
+            return std::make_pair(present ? m_max : this->end(), false);
+        }
+
+        std::pair<iterator,bool> res = Set::insert(value);
+        if (!res.second) return res;
+        if (this->size() > m_capacity)
+        {
+            iterator victim = m_max--;
+            Set::erase(victim);
+        }
+        else
+        if (m_max == this->end() || comp(*m_max, value))
+        {
+            m_max = res.first;
+        }
+        return res;
+    }
+
+    iterator insert(iterator position, const value_type &value)
+    {
+        (void)position;
+        return insert(value).first;
+    }
+
+    /* Admits a batch of elements.  Once the set is full, values that are not
+       less than the greatest element are skipped; the others are inserted
+       without evicting, and the overflow is erased whenever it reaches the
+       capacity, and at the end. */
+    template<class InputIterator>
+    void insert(InputIterator first, InputIterator last)
+    {
+        const key_compare &comp = this->key_comp();
+        for (; first != last; ++first)
+        {
+            const value_type &value = *first;
+            if (this->size() >= m_capacity && (m_capacity == 0 || !comp(value, *m_max)))
+                continue;
+            std::pair<iterator,bool> res = Set::insert(value);
+            if (res.second && (m_max == this->end() || comp(*m_max, value)))
+                m_max = res.first;
+            if (this->size() >= 2*m_capacity) truncate();
+        }
+        truncate();
+    }
+
+    template<class InputIterator>
+    void assign(InputIterator first, InputIterator last, unsigned threads = 0)
+    {
+        Set::assign(first, last, threads);
+        truncate();
+    }
+
+    // A value greater than all elements is only admitted if the set is not full.
+    std::pair<iterator,bool> push_back(const value_type &value)
+    {
+        if (m_max != this->end() && !this->key_comp()(*m_max, value)) return insert(value);
+        if (this->size() >= m_capacity) return std::make_pair(this->end(), false);
+        std::pair<iterator,bool> res = Set::push_back(value);
+        m_max = res.first;
+        return res;
+    }
+
+    template<class InputIterator>
+    void append(InputIterator first, InputIterator last)
+    {
+        while (first != last) push_back(*first++);
+    }
+
+    void erase(iterator pos)
+    {
+        bool greatest_erased = pos == m_max;
+        Set::erase(pos);
+        if (greatest_erased) m_max = greatest();
+    }
+
+    void erase(iterator first, iterator last)
+    {
+        Set::erase(first, last);
+        if (last == this->end()) m_max = greatest();
+    }
+
+    size_type erase(const key_type &key)
+    {
+        iterator it = this->find(key);
+        if (it == this->end()) return 0;
+        erase(it);
+        return 1;
+    }
+
+    /* Replaces the element at `pos`, as RbstSet::replace() does.  The size
+       does not grow, so nothing is evicted; but elements that were evicted
+       earlier are not restored if the new value is greater. */
+    std::pair<iterator,bool> replace(iterator pos, const value_type &value)
+    {
+        std::pair<iterator,bool> res = Set::replace(pos, value);
+        m_max = greatest();
+        return res;
+    }
+
+    void swap(RbstBoundedSet &that)
+    {
+        Set::swap(that);
+        std::swap(m_capacity, that.m_capacity);
+        m_max = greatest();
+        that.m_max = that.greatest();
+    }
+
+protected:
+    // Returns an iterator to the greatest element, or end() if empty.
+    const_iterator greatest() const
+    {
+        return this->empty() ? this->end() : --this->end();
+    }
+
+    // Erases elements beyond the capacity, and updates the cached maximum.
+    void truncate()
+    {
+        if (this->size() > m_capacity)
+            Set::erase(this->begin() + m_capacity, this->end());
+        m_max = greatest();
+    }
+
+    size_type       m_capacity;
+    const_iterator  m_max;
+};
+
+#endif  /* ndef RBST_BOUNDED_SET_H_INCLUDED */
@@ -2,6 +2,7 @@
 #define RBST_CHECK_H_INCLUDED
 
 #include "RbstNode.h"
+#include "RbstHash.h"
 #include <iostream>
 
 /* Checks the internal consistency of the RBST structure; if errors are found,
@@ -88,6 +89,73 @@ bool rbst_check_values( const RbstValuedNode<V> *node,
     return rbst_check_values<V, std::less<V> >(node, index, comp, os);
 }
 
+/* Checks that the RBST satisfies the weight-balance invariant maintained by
+   RbstWeightBalanced; if errors are found, a message is written to `os` and
+   `false` is returned. */
+bool rbst_check_weight_balance( const RbstNode *node, size_t index = 0,
+                                std::ostream &os = std::cerr )
+{
+    // Empty tree is valid.
+    if (!node) return true;
+
+    const RbstNode *left  = node->left(),
+                   *right = node->right();
+
+    // Check left subtree:
+    if (left && !rbst_check_weight_balance(left, index, os))
+        return false;
+
+    // Check invariants at current node:
+    size_t node_index = index + RbstNode::size(left);
+    if (!RbstWeightBalanced::balanced(RbstNode::size(left), RbstNode::size(right)))
+    {
+        os << "Subtrees of node " << node_index << " (" << node << ")"
+           << " are not weight-balanced: " << RbstNode::size(left)
+           << " vs. " << RbstNode::size(right) << "\n";
+        return false;
+    }
+
+    // Check right subtree:
+    if (right && !rbst_check_weight_balance(right, node_index + 1, os))
+        return false;
+
+    return true;
+}
+
+/* Checks that the subtree hashes of an RbstHashedNode tree match its values;
+   if errors are found, a message is written to `os` and `false` is returned. */
+template<class V, class Hash>
+bool rbst_check_hashes( const RbstHashedNode<V, Hash> *node, size_t index = 0,
+                        std::ostream &os = std::cerr )
+{
+    // Empty tree is valid.
+    if (!node) return true;
+
+    const RbstHashedNode<V, Hash> *left  = node->left(),
+                                  *right = node->right();
+
+    // Check left subtree:
+    if (left && !rbst_check_hashes(left, index, os))
+        return false;
+
+    // Check invariants at current node:
+    size_t node_index = index + RbstNode::size(left);
+    uint64_t hash = RbstHashedNode<V, Hash>::value_hash(node->value()) +
+        RbstHashedNode<V, Hash>::hash(left) + RbstHashedNode<V, Hash>::hash(right);
+    if (node->hash() != hash)
+    {
+        os << "Incorrect hash at node " << node_index << " (" << node << "): "
+           << node->hash() << " (should be: " << hash << ")\n";
+        return false;
+    }
+
+    // Check right subtree:
+    if (right && !rbst_check_hashes(right, node_index + 1, os))
+        return false;
+
+    return true;
+}
+
 // Returns the maximum depth of a tree.
 static size_t rbst_max_depth(const RbstNode *node)
 {
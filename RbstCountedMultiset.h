@@ -0,0 +1,156 @@
+#ifndef RBST_COUNTED_MULTISET_H_INCLUDED
+#define RBST_COUNTED_MULTISET_H_INCLUDED
+
+#include "RbstSet.h"
+#include "RbstWeighted.h"
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <utility>
+
+// Entries (key, count) ordered by their keys, and weighted by their counts.
+template<class Key, class Comparator>
+struct RbstEntryCompare
+{
+    RbstEntryCompare(const Comparator &comp = Comparator()) : comp(comp) { }
+
+    bool operator()( const std::pair<Key, size_t> &a,
+                     const std::pair<Key, size_t> &b ) const
+    {
+        return comp(a.first, b.first);
+    }
+
+    Comparator comp;
+};
+
+template<class Key>
+struct RbstEntryWeight
+{
+    size_t operator()(const std::pair<Key, size_t> &entry) const
+    {
+        return entry.second;
+    }
+};
+
+/* An RbstCountedMultiset is a multiset which stores each distinct key once,
+   together with its multiplicity.  For data with many duplicates this takes
+   far less memory than a node per occurrence, and insert(key, k) and
+   erase(key, k) take O(log D) expected time regardless of k, where D is the
+   number of distinct keys.  Nodes are weighted by their multiplicities, so
+   that at() and rank() index into the expanded sequence of elements (in which
+   each key is repeated as often as it occurs) in O(log D) expected time.
+
+   The distinct keys and their counts can be accessed (in order) through
+   entries(). */
+template< class Key,
+          class Comparator = std::less<Key>,
+          class Allocator = std::allocator<std::pair<Key, size_t> >,
+          class Rng = DefaultRng >
+class RbstCountedMultiset
+    : protected RbstSet< std::pair<Key, size_t>, RbstEntryCompare<Key, Comparator>,
+                         Allocator, Rng,
+                         RbstWeightedNode<std::pair<Key, size_t>, RbstEntryWeight<Key> > >
+{
+public:
+    typedef Key key_type, value_type;
+    typedef Comparator key_compare;
+    typedef std::pair<Key, size_t> entry_type;
+    typedef size_t size_type;
+
+    explicit RbstCountedMultiset(const Comparator &comp = Comparator())
+        : Set(RbstEntryCompare<Key, Comparator>(comp)) { }
+
+    bool empty() const { return Set::empty(); }
+    void clear() { Set::clear(); }
+
+    // Returns the number of elements, counting duplicates.
+    size_type size() const { return node_type::weight(this->root()); }
+
+    // Returns the number of distinct keys.
+    size_type distinct_size() const { return Set::size(); }
+
+    // Returns a view of the distinct keys and their counts, in order.
+    RbstSetRange<entry_type> entries() const { return Set::range(); }
+
+    // Returns how many times `key` occurs.
+    size_type count(const Key &key) const
+    {
+        const_iterator it = Set::find(entry_type(key, 0));
+        return it == this->end() ? 0 : it->second;
+    }
+
+    // Returns the element at index `i` (counting duplicates), which must be
+    // less than size().
+    const Key &at(size_type i) const
+    {
+        return node_type::at_weight(this->root(), i)->value().first;
+    }
+
+    // Returns the number of elements less than `key`, which is the index of
+    // its first occurrence if it occurs.
+    size_type rank(const Key &key) const
+    {
+        const Comparator &comp = this->key_comp().comp;
+        size_type res = 0;
+        for (const node_type *node = this->root(); node; )
+        {
+            if (comp(node->value().first, key))
+            {
+                res += node->weight() - node_type::weight(node->right());
+                node = node->right();
+            }
+            else
+            {
+                node = node->left();
+            }
+        }
+        return res;
+    }
+
+    // Adds `k` occurrences of `key`, and returns its new count.
+    size_type insert(const Key &key, size_type k = 1)
+    {
+        if (k == 0) return count(key);
+        std::pair<const_iterator, bool> res = Set::insert(entry_type(key, k));
+        if (res.second) return k;
+        set_count(res.first, res.first->second + k);
+        return res.first->second;
+    }
+
+    // Removes up to `k` occurrences of `key`, and returns how many were removed.
+    size_type erase(const Key &key, size_type k)
+    {
+        const_iterator it = Set::find(entry_type(key, 0));
+        if (it == this->end() || k == 0) return 0;
+        size_type n = it->second;
+        if (k >= n)
+        {
+            Set::erase(it);
+            return n;
+        }
+        set_count(it, n - k);
+        return k;
+    }
+
+    // Removes all occurrences of `key`, and returns how many were removed.
+    size_type erase(const Key &key) { return erase(key, (size_type)-1); }
+
+    void swap(RbstCountedMultiset &that) { Set::swap(that); }
+
+protected:
+    typedef RbstSet< entry_type, RbstEntryCompare<Key, Comparator>, Allocator, Rng,
+                     RbstWeightedNode<entry_type, RbstEntryWeight<Key> > > Set;
+    typedef typename Set::node_type node_type;
+    typedef typename Set::const_iterator const_iterator;
+
+    // Changes the count of the entry at `it`.
+    void set_count(const_iterator it, size_type n)
+    {
+        node_type *node = Set::node_of(it);
+        node->set_value(entry_type(it->first, n));
+        typename node_type::update_type update;
+        node->update_path(update);
+    }
+};
+
+#endif  /* ndef RBST_COUNTED_MULTISET_H_INCLUDED */
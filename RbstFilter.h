@@ -0,0 +1,245 @@
+#ifndef RBST_FILTER_H_INCLUDED
+#define RBST_FILTER_H_INCLUDED
+
+#include "RbstHash.h"
+#include "RbstSet.h"
+#include <stdint.h>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Sets with a filter in front of the tree, which answers lookups of most
+// absent keys without searching the tree.
+
+/* Counting Bloom filter, which keeps a counter for each of a number of slots
+   and supports erasing as well as inserting keys.  Each key is mapped to
+   `hashes` slots within a single block of `block_size` slots, so that testing
+   a key touches only one block of memory (one or two cache lines).  Counters
+   saturate at 255, after which they are never decremented; this only makes
+   the filter less precise.  With `slots_per_key` slots per key, about 3% of
+   absent keys pass the filter.  Keys are tested by their hash only, so keys
+   with equal hashes are indistinguishable. */
+template<class Key, class Hash = RbstHash<Key> >
+class RbstCountingFilter
+{
+public:
+    static const size_t block_size = 64, hashes = 4, slots_per_key = 8;
+
+    RbstCountingFilter() { reset(0); }
+
+    // Returns the number of keys the filter is sized for.
+    size_t capacity() const { return m_counters.size()/slots_per_key; }
+
+    // Removes all keys, and resizes the filter for `n` keys.
+    void reset(size_t n)
+    {
+        size_t blocks = 1;
+        while (blocks*block_size < n*slots_per_key) blocks *= 2;
+        m_counters.assign(blocks*block_size, 0);
+        m_mask = blocks - 1;
+    }
+
+    void insert(const Key &key)
+    {
+        uint64_t h = rbst_mix_hash(Hash()(key));
+        uint8_t *block = &m_counters[((h >> 32) & m_mask)*block_size];
+        for (size_t i = 0; i < hashes; ++i, h >>= 6)
+        {
+            uint8_t &counter = block[h % block_size];
+            if (counter < 255) ++counter;
+        }
+    }
+
+    // Erases a key, which must have been inserted before.
+    void erase(const Key &key)
+    {
+        uint64_t h = rbst_mix_hash(Hash()(key));
+        uint8_t *block = &m_counters[((h >> 32) & m_mask)*block_size];
+        for (size_t i = 0; i < hashes; ++i, h >>= 6)
+        {
+            uint8_t &counter = block[h % block_size];
+            if (counter < 255) --counter;
+        }
+    }
+
+    // Returns false if `key` is definitely absent, or true if it may be present.
+    bool may_contain(const Key &key) const
+    {
+        uint64_t h = rbst_mix_hash(Hash()(key));
+        const uint8_t *block = &m_counters[((h >> 32) & m_mask)*block_size];
+        for (size_t i = 0; i < hashes; ++i, h >>= 6)
+            if (block[h % block_size] == 0) return false;
+        return true;
+    }
+
+    void swap(RbstCountingFilter &other)
+    {
+        m_counters.swap(other.m_counters);
+        std::swap(m_mask, other.m_mask);
+    }
+
+private:
+    std::vector<uint8_t> m_counters;
+    uint64_t m_mask;
+};
+
+/* An RbstFilteredSet is an RbstSet (given by the `Set` template argument) with
+   a filter, like RbstCountingFilter, which contains all of its keys.  find(),
+   count() and erase(key) consult the filter first, and skip searching the tree
+   if the key is definitely absent.  All other operations are inherited.  The
+   filter is resized (and rebuilt) whenever the set grows beyond its capacity,
+   which takes amortized O(1) time per insertion.
+
+   The filter's Hash must map keys that are equivalent under the set's
+   comparator to equal hashes (for example, with a case-insensitive
+   comparator, the hash must ignore case), since otherwise lookups of an
+   equivalent key find it absent.  The default hash only agrees with
+   comparators that order keys by their value, like std::less.
+
+   The set must not be modified through a reference to the base class, since
+   that would bypass the filter! */
+template< class Set,
+          class Filter = RbstCountingFilter<typename Set::key_type> >
+class RbstFilteredSet : public Set
+{
+public:
+    typedef typename Set::key_type          key_type;
+    typedef typename Set::value_type        value_type;
+    typedef typename Set::size_type         size_type;
+    typedef typename Set::key_compare       key_compare;
+    typedef typename Set::allocator_type    allocator_type;
+    typedef typename Set::iterator          iterator;
+    typedef typename Set::const_iterator    const_iterator;
+
+    explicit RbstFilteredSet( const key_compare &comp = key_compare(),
+                              const allocator_type &alloc = allocator_type() )
+        : Set(comp, alloc) { }
+
+    template<class InputIterator>
+    RbstFilteredSet( InputIterator first, InputIterator last,
+                     const key_compare &comp = key_compare(),
+                     const allocator_type &alloc = allocator_type() )
+        : Set(comp, alloc)
+    {
+        insert(first, last);
+    }
+
+    void clear()
+    {
+        Set::clear();
+        m_filter.reset(0);
+    }
+
+    std::pair<iterator,bool> insert(const value_type &value)
+    {
+        std::pair<iterator,bool> res = Set::insert(value);
+        if (res.second) added(value);
+        return res;
+    }
+
+    iterator insert(iterator position, const value_type &value)
+    {
+        (void)position;
+        return insert(value).first;
+    }
+
+    template<class InputIterator>
+    void insert(InputIterator first, InputIterator last)
+    {
+        if (this->empty())
+        {
+            Set::insert(first, last);
+            rebuild_filter(this->size());
+            return;
+        }
+        while (first != last) insert(*first++);
+    }
+
+    template<class InputIterator>
+    void assign(InputIterator first, InputIterator last, unsigned threads = 0)
+    {
+        Set::assign(first, last, threads);
+        rebuild_filter(this->size());
+    }
+
+    std::pair<iterator,bool> push_back(const value_type &value)
+    {
+        std::pair<iterator,bool> res = Set::push_back(value);
+        if (res.second) added(value);
+        return res;
+    }
+
+    template<class InputIterator>
+    void append(InputIterator first, InputIterator last)
+    {
+        while (first != last) push_back(*first++);
+    }
+
+    void erase(iterator pos)
+    {
+        m_filter.erase(*pos);
+        Set::erase(pos);
+    }
+
+    void erase(iterator first, iterator last)
+    {
+        while (first != last) erase(first++);
+    }
+
+    size_type erase(const key_type &key)
+    {
+        if (!m_filter.may_contain(key)) return 0;
+        iterator it = Set::find(key);
+        if (it == this->end()) return 0;
+        erase(it);
+        return 1;
+    }
+
+    std::pair<iterator,bool> replace(iterator pos, const value_type &value)
+    {
+        m_filter.erase(*pos);
+        std::pair<iterator,bool> res = Set::replace(pos, value);
+        if (res.second) m_filter.insert(value);
+        return res;
+    }
+
+    size_type count(const key_type &key) const
+    {
+        return m_filter.may_contain(key) && Set::count(key);
+    }
+
+    const_iterator find(const key_type &key) const
+    {
+        return m_filter.may_contain(key) ? Set::find(key) : this->end();
+    }
+
+    void swap(RbstFilteredSet &that)
+    {
+        Set::swap(that);
+        m_filter.swap(that.m_filter);
+    }
+
+    const Filter &filter() const { return m_filter; }
+
+protected:
+    // Adds a newly inserted key to the filter, growing it if it is full.
+    void added(const value_type &value)
+    {
+        if (this->size() > m_filter.capacity())
+            rebuild_filter(2*this->size());
+        else
+            m_filter.insert(value);
+    }
+
+    // Resizes the filter for `n` keys, and adds all keys of the set to it.
+    void rebuild_filter(size_type n)
+    {
+        m_filter.reset(n);
+        for (const_iterator it = this->begin(); it != this->end(); ++it)
+            m_filter.insert(*it);
+    }
+
+    Filter m_filter;
+};
+
+#endif  /* ndef RBST_FILTER_H_INCLUDED */
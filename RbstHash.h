@@ -0,0 +1,216 @@
+#ifndef RBST_HASH_H_INCLUDED
+#define RBST_HASH_H_INCLUDED
+
+#include "RbstNode.h"
+#include <stdint.h>
+#include <cstddef>
+#include <limits>
+
+#if __cplusplus >= 201103L
+#include <functional>
+#endif
+
+// Tree nodes augmented with a hash of the values in their subtree, which
+// allows two sets to be compared and diffed without visiting equal parts.
+
+/* Default hash function for keys.  Integers are hashed as themselves; other
+   keys require C++11, where std::hash is used. */
+template<class V, bool Integer = std::numeric_limits<V>::is_integer>
+struct RbstHash
+#if __cplusplus >= 201103L
+{
+    uint64_t operator()(const V &value) const { return std::hash<V>()(value); }
+}
+#endif
+;
+
+template<class V>
+struct RbstHash<V, true>
+{
+    uint64_t operator()(const V &value) const { return (uint64_t)value; }
+};
+
+// Scrambles the bits of a hash value (the SplitMix64 finalizer).
+inline uint64_t rbst_mix_hash(uint64_t x)
+{
+    x = (x ^ (x >> 30))*0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27))*0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/* An RbstHashedNode extends an RbstValuedNode with the hash of the values in
+   its subtree, which is the sum (modulo 2^64) of the mixed hashes of the
+   values.  Unlike a hash of the tree structure, this depends only on the set
+   of values, so trees of different shapes (for example, of two replicas with
+   differently seeded RNGs) can be compared by key ranges.  The subtree hashes
+   are maintained by passing update_type to the RbstNode tree algorithms,
+   which RbstSet does for its node type. */
+template<class V, class Hash = RbstHash<V> >
+class RbstHashedNode : public RbstValuedNode<V>
+{
+public:
+    RbstHashedNode( const V &value, RbstNode *left = NULL,
+                    RbstNode *right = NULL, RbstNode *parent = NULL )
+        : RbstValuedNode<V>(value, left, right, parent)
+    {
+        update_type()(this);
+    }
+
+    // Recomputes the subtree hash of a node from its value and children.
+    struct update_type
+    {
+        void operator()(RbstNode *node) const
+        {
+            RbstHashedNode *n = static_cast<RbstHashedNode*>(node);
+            n->m_hash = value_hash(n->value()) + hash(n->left()) + hash(n->right());
+        }
+    };
+
+    const RbstHashedNode* left() const  { return static_cast<const RbstHashedNode*>(this->m_left); }
+    const RbstHashedNode* right() const { return static_cast<const RbstHashedNode*>(this->m_right); }
+
+    // Returns the hash of the values in the subtree rooted at this node, or
+    // at `node` (0 if `node` is NULL).
+    uint64_t hash() const { return m_hash; }
+    static uint64_t hash(const RbstHashedNode *node) { return node ? node->m_hash : 0; }
+
+    // Returns the contribution of a single value to the subtree hash.
+    static uint64_t value_hash(const V &value) { return rbst_mix_hash(Hash()(value)); }
+
+    /* Computes the number and hash of the values in the subtree rooted at
+       `node` which lie strictly between `lo` and `hi` (a NULL bound means the
+       range is unbounded on that side) in O(depth) time. */
+    template<class Comparator>
+    static void range_hash( const RbstHashedNode *node, const V *lo, const V *hi,
+        Comparator &comp, size_t &count, uint64_t &sum );
+
+    /* Writes the values in the subtree at `a` but not in the subtree at `b`
+       to `only_a`, and vice versa to `only_b`, both in order, restricted to
+       values strictly between `lo` and `hi`.  The subtree at `a` is traversed
+       recursively, and each of its subtrees whose count and hash equal those
+       of the same key range in `b` is skipped, so that k differences are
+       found by visiting O(k log N) nodes of `a`, each with an O(log N) range
+       query on `b`.  (Sets with equal hashes are assumed to be equal; with
+       64-bit hashes, a collision is unlikely but not impossible.) */
+    template<class Comparator, class OutputIterator1, class OutputIterator2>
+    static void diff( const RbstHashedNode *a, const RbstHashedNode *b,
+        Comparator &comp, OutputIterator1 &only_a, OutputIterator2 &only_b,
+        const V *lo = NULL, const V *hi = NULL );
+
+    /* Copies the values in the subtree rooted at `node` which lie strictly
+       between `lo` and `hi` in order to `out`. */
+    template<class Comparator, class OutputIterator>
+    static OutputIterator copy_range( const RbstHashedNode *node,
+        const V *lo, const V *hi, Comparator &comp, OutputIterator out );
+
+protected:
+    uint64_t m_hash;
+};
+
+template<class V, class Hash> template<class Comparator>
+void RbstHashedNode<V, Hash>::range_hash( const RbstHashedNode *node,
+    const V *lo, const V *hi, Comparator &comp, size_t &count, uint64_t &sum )
+{
+    count = 0;
+    sum   = 0;
+
+    // Find the topmost node in range; all others are in its subtree.
+    while (node)
+    {
+        if (lo && !comp(*lo, node->value()))
+            node = node->right();
+        else
+        if (hi && !comp(node->value(), *hi))
+            node = node->left();
+        else
+            break;
+    }
+    if (!node) return;
+    count = 1;
+    sum   = value_hash(node->value());
+
+    // Add values greater than `lo` in the left subtree:
+    for (const RbstHashedNode *n = node->left(); n; )
+    {
+        if (lo && !comp(*lo, n->value())) { n = n->right(); continue; }
+        count += 1 + RbstNode::size(n->right());
+        sum   += n->m_hash - hash(n->left());
+        n = n->left();
+    }
+
+    // Add values less than `hi` in the right subtree:
+    for (const RbstHashedNode *n = node->right(); n; )
+    {
+        if (hi && !comp(n->value(), *hi)) { n = n->left(); continue; }
+        count += 1 + RbstNode::size(n->left());
+        sum   += n->m_hash - hash(n->right());
+        n = n->right();
+    }
+}
+
+template<class V, class Hash>
+template<class Comparator, class OutputIterator1, class OutputIterator2>
+void RbstHashedNode<V, Hash>::diff( const RbstHashedNode *a,
+    const RbstHashedNode *b, Comparator &comp, OutputIterator1 &only_a,
+    OutputIterator2 &only_b, const V *lo, const V *hi )
+{
+    // Narrow down `b` to the subtree containing all values in (lo, hi):
+    while (b)
+    {
+        if (lo && !comp(*lo, b->value()))
+            b = b->right();
+        else
+        if (hi && !comp(b->value(), *hi))
+            b = b->left();
+        else
+            break;
+    }
+
+    size_t count;
+    uint64_t sum;
+    range_hash(b, lo, hi, comp, count, sum);
+    if (count == RbstNode::size(a) && sum == hash(a)) return;
+    if (!a)
+    {
+        only_b = copy_range(b, lo, hi, comp, only_b);
+        return;
+    }
+    if (count == 0)
+    {
+        only_a = RbstValuedNode<V>::copy(a, only_a);
+        return;
+    }
+    diff(a->left(), b, comp, only_a, only_b, lo, &a->value());
+    if (!RbstValuedNode<V>::find(b, a->value(), comp)) *only_a++ = a->value();
+    diff(a->right(), b, comp, only_a, only_b, &a->value(), hi);
+}
+
+template<class V, class Hash> template<class Comparator, class OutputIterator>
+OutputIterator RbstHashedNode<V, Hash>::copy_range( const RbstHashedNode *node,
+    const V *lo, const V *hi, Comparator &comp, OutputIterator out )
+{
+    while (node)
+    {
+        if (lo && !comp(*lo, node->value()))
+        {
+            node = node->right();
+        }
+        else
+        if (hi && !comp(node->value(), *hi))
+        {
+            node = node->left();
+        }
+        else
+        {
+            // Values in the left subtree are less than `hi`, and values in
+            // the right subtree are greater than `lo`:
+            out = copy_range(node->left(), lo, NULL, comp, out);
+            *out++ = node->value();
+            lo = NULL;
+            node = node->right();
+        }
+    }
+    return out;
+}
+
+#endif  /* ndef RBST_HASH_H_INCLUDED */
@@ -0,0 +1,299 @@
+#ifndef RBST_HASH_INDEX_H_INCLUDED
+#define RBST_HASH_INDEX_H_INCLUDED
+
+#include "RbstHash.h"
+#include "RbstSet.h"
+#include <stdint.h>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Sets with a hash table next to the tree, which finds keys in O(1) expected
+// time while the tree still provides ordered access and ranks.
+
+/* Open-addressing hash table that maps keys to set iterators, using linear
+   probing.  Erased entries are removed by shifting later entries of the
+   same probe sequence back, so no tombstones are needed.  The table is kept
+   at most half full.  `Equal` decides whether two keys are equivalent, and
+   `Hash` must map equivalent keys to equal hashes. */
+template<class Key, class Iterator, class Hash, class Equal>
+class RbstHashIndex
+{
+public:
+    RbstHashIndex(const Equal &equal) : m_equal(equal) { reset(0); }
+
+    size_t size() const { return m_size; }
+
+    // Removes all entries, and resizes the table for `n` entries.
+    void reset(size_t n)
+    {
+        size_t capacity = 8;
+        while (capacity < 2*n) capacity *= 2;
+        m_slots.assign(capacity, Slot());
+        m_mask = capacity - 1;
+        m_size = 0;
+    }
+
+    // Returns the iterator for `key`, or a default-constructed iterator.
+    Iterator find(const Key &key) const
+    {
+        uint64_t h = hash(key);
+        for (size_t i = h & m_mask; m_slots[i].it != Iterator(); i = (i + 1) & m_mask)
+            if (m_slots[i].hash == h && m_equal(*m_slots[i].it, key)) return m_slots[i].it;
+        return Iterator();
+    }
+
+    // Adds the iterator `it`, whose key must not be in the table yet.
+    void insert(Iterator it)
+    {
+        if (2*(m_size + 1) > m_slots.size()) grow();
+        Slot slot = { it, hash(*it) };
+        size_t i = slot.hash & m_mask;
+        while (m_slots[i].it != Iterator()) i = (i + 1) & m_mask;
+        m_slots[i] = slot;
+        ++m_size;
+    }
+
+    // Removes the entry for `key`, if any.
+    void erase(const Key &key)
+    {
+        uint64_t h = hash(key);
+        size_t i = h & m_mask;
+        for (;;)
+        {
+            if (m_slots[i].it == Iterator()) return;
+            if (m_slots[i].hash == h && m_equal(*m_slots[i].it, key)) break;
+            i = (i + 1) & m_mask;
+        }
+
+        // Move back later entries whose home slot is not in (i, j]:
+        for (size_t j = (i + 1) & m_mask; m_slots[j].it != Iterator(); j = (j + 1) & m_mask)
+        {
+            size_t home = m_slots[j].hash & m_mask;
+            if (((j - home) & m_mask) >= ((j - i) & m_mask))
+            {
+                m_slots[i] = m_slots[j];
+                i = j;
+            }
+        }
+        m_slots[i] = Slot();
+        --m_size;
+    }
+
+    void swap(RbstHashIndex &other)
+    {
+        m_slots.swap(other.m_slots);
+        std::swap(m_mask, other.m_mask);
+        std::swap(m_size, other.m_size);
+        std::swap(m_equal, other.m_equal);
+    }
+
+private:
+    struct Slot
+    {
+        Iterator it;
+        uint64_t hash;
+    };
+
+    static uint64_t hash(const Key &key) { return rbst_mix_hash(Hash()(key)); }
+
+    // Doubles the capacity of the table.
+    void grow()
+    {
+        std::vector<Slot> slots(2*m_slots.size(), Slot());
+        slots.swap(m_slots);
+        m_mask = m_slots.size() - 1;
+        m_size = 0;
+        for (size_t i = 0; i < slots.size(); ++i)
+            if (slots[i].it != Iterator()) insert(slots[i].it);
+    }
+
+    std::vector<Slot> m_slots;
+    size_t m_mask, m_size;
+    Equal m_equal;
+};
+
+/* An RbstHashIndexedSet is an RbstSet (given by the `Set` template argument)
+   with an RbstHashIndex of all its elements.  find(), count(), erase(key) and
+   index_of() look keys up in the hash table in O(1) expected time instead of
+   searching the tree; all other operations (lower_bound(), random access,
+   iteration, etc.) are inherited and use the tree.  Insertion and erasure
+   update both.
+
+   The set must not be modified through a reference to the base class, since
+   that would bypass the hash table! */
+template< class Set,
+          class Hash = RbstHash<typename Set::key_type> >
+class RbstHashIndexedSet : public Set
+{
+public:
+    typedef typename Set::key_type          key_type;
+    typedef typename Set::value_type        value_type;
+    typedef typename Set::size_type         size_type;
+    typedef typename Set::key_compare       key_compare;
+    typedef typename Set::allocator_type    allocator_type;
+    typedef typename Set::iterator          iterator;
+    typedef typename Set::const_iterator    const_iterator;
+
+    explicit RbstHashIndexedSet( const key_compare &comp = key_compare(),
+                                 const allocator_type &alloc = allocator_type() )
+        : Set(comp, alloc), m_index(Equivalent(comp)) { }
+
+    template<class InputIterator>
+    RbstHashIndexedSet( InputIterator first, InputIterator last,
+                        const key_compare &comp = key_compare(),
+                        const allocator_type &alloc = allocator_type() )
+        : Set(comp, alloc), m_index(Equivalent(comp))
+    {
+        insert(first, last);
+    }
+
+    // The index refers to nodes, so it is rebuilt for copies:
+    RbstHashIndexedSet(const RbstHashIndexedSet &that)
+        : Set(that), m_index(Equivalent(that.key_comp()))
+    {
+        rebuild_index();
+    }
+
+    RbstHashIndexedSet &operator=(const RbstHashIndexedSet &that)
+    {
+        if (this != &that)
+        {
+            Set::operator=(that);
+            m_index = Index(Equivalent(that.key_comp()));
+            rebuild_index();
+        }
+        return *this;
+    }
+
+    void clear()
+    {
+        Set::clear();
+        m_index.reset(0);
+    }
+
+    std::pair<iterator,bool> insert(const value_type &value)
+    {
+        iterator it = m_index.find(value);
+        if (it != iterator()) return std::make_pair(it, false);
+        std::pair<iterator,bool> res = Set::insert(value);
+        m_index.insert(res.first);
+        return res;
+    }
+
+    iterator insert(iterator position, const value_type &value)
+    {
+        (void)position;
+        return insert(value).first;
+    }
+
+    template<class InputIterator>
+    void insert(InputIterator first, InputIterator last)
+    {
+        if (this->empty())
+        {
+            Set::insert(first, last);
+            rebuild_index();
+            return;
+        }
+        while (first != last) insert(*first++);
+    }
+
+    template<class InputIterator>
+    void assign(InputIterator first, InputIterator last, unsigned threads = 0)
+    {
+        Set::assign(first, last, threads);
+        rebuild_index();
+    }
+
+    std::pair<iterator,bool> push_back(const value_type &value)
+    {
+        std::pair<iterator,bool> res = Set::push_back(value);
+        if (res.second) m_index.insert(res.first);
+        return res;
+    }
+
+    template<class InputIterator>
+    void append(InputIterator first, InputIterator last)
+    {
+        while (first != last) push_back(*first++);
+    }
+
+    void erase(iterator pos)
+    {
+        m_index.erase(*pos);
+        Set::erase(pos);
+    }
+
+    void erase(iterator first, iterator last)
+    {
+        while (first != last) erase(first++);
+    }
+
+    size_type erase(const key_type &key)
+    {
+        iterator it = m_index.find(key);
+        if (it == iterator()) return 0;
+        erase(it);
+        return 1;
+    }
+
+    std::pair<iterator,bool> replace(iterator pos, const value_type &value)
+    {
+        m_index.erase(*pos);
+        std::pair<iterator,bool> res = Set::replace(pos, value);
+        if (res.second) m_index.insert(res.first);
+        return res;
+    }
+
+    size_type count(const key_type &key) const
+    {
+        return m_index.find(key) != iterator();
+    }
+
+    const_iterator find(const key_type &key) const
+    {
+        const_iterator it = m_index.find(key);
+        return it != const_iterator() ? it : this->end();
+    }
+
+    /* Returns the index of the element equal to `key`, or size() if there is
+       none.  This takes O(log N) time, to climb from the node to the root. */
+    size_type index_of(const key_type &key) const
+    {
+        // Since the index of end() is size(), this climbs only once:
+        return this->size() + (find(key) - this->end());
+    }
+
+    void swap(RbstHashIndexedSet &that)
+    {
+        Set::swap(that);
+        m_index.swap(that.m_index);
+    }
+
+protected:
+    // Equivalence predicate for the hash index.
+    struct Equivalent
+    {
+        Equivalent(const key_compare &comp) : comp(comp) { }
+        bool operator()(const key_type &a, const key_type &b) const
+        {
+            return !comp(a, b) && !comp(b, a);
+        }
+        key_compare comp;
+    };
+
+    typedef RbstHashIndex<key_type, const_iterator, Hash, Equivalent> Index;
+
+    // Adds all elements of the set to an empty index.
+    void rebuild_index()
+    {
+        m_index.reset(this->size());
+        for (const_iterator it = this->begin(); it != this->end(); ++it)
+            m_index.insert(it);
+    }
+
+    Index m_index;
+};
+
+#endif  /* ndef RBST_HASH_INDEX_H_INCLUDED */
@@ -4,9 +4,45 @@
 #include <cstddef>
 #include <algorithm>
 #include <functional>
+#include <vector>
 
 // Randomized Binary Search Tree implementation.
 
+/* Tag type that may be passed to the tree algorithms below in place of a
+   random number generator, to select deterministic weight-balanced (BB[alpha])
+   rebalancing instead of randomized balancing.  Subtree sizes are kept within
+   a factor `delta` of each other by single and double rotations, which bounds
+   the depth of a tree with N nodes by O(log N) in the worst case.  The
+   parameters (delta, ratio) = (3, 2) are those proven correct by Hirai and
+   Yamamoto for insertion and deletion. */
+struct RbstWeightBalanced
+{
+    static const size_t delta = 3, ratio = 2;
+
+    // The tag can be constructed from a seed, like a random number generator.
+    RbstWeightBalanced(size_t seed = 0) { (void)seed; }
+
+    /* Where a random split point in [0, n) is required (for example, to build
+       a tree from sorted values) the middle is chosen instead, which results
+       in perfectly balanced trees. */
+    size_t operator()(size_t n) const { return n/2; }
+
+    /* Returns whether subtrees of size `a` and `b` may be siblings in a
+       weight-balanced tree: */
+    static bool balanced(size_t a, size_t b)
+    {
+        return a + b <= 1 || (a <= delta*b && b <= delta*a);
+    }
+};
+
+class RbstNode;
+
+// Update hook for the tree algorithms below that does nothing.
+struct RbstNoUpdate
+{
+    void operator()(RbstNode *) const { }
+};
+
 /* RbstNode models a tree node with associate size, and pointers to the
    parent node, left child node, and right child node. */
 class RbstNode
@@ -41,11 +77,17 @@ public:
     const RbstNode *previous() const;
 
     /* Retrieve a successor/predecessor of this node at offset `d`, or NULL if
-       the requested node is out of range.  For example, node->offset(1) is
+       the requested node is out of range.  For example, node->next() is
        equivalent to node->offset(1), and node->previous() to node->offset(-1).
-    */
+       Offsets up to `small_offset` are resolved by stepping through the
+       successors/predecessors, larger ones in O(log N) time by climbing up to
+       a common ancestor of both nodes. */
     const RbstNode *offset(ptrdiff_t d) const;
 
+    // Climbing visits fewer nodes than stepping already for |d| >= 2 (see the
+    // "offset" benchmark in RbstBench.cpp), so only single steps are special.
+    static const ptrdiff_t small_offset = 1;
+
     /* Returns the 0-based index of the current node in the tree, i.e. the
        index i such that root->at(i) == this */
     inline size_t index() const;
@@ -55,11 +97,20 @@ public:
        NULL) then at(i) is equivalent to first()->offset(i). */
     inline RbstNode *at(size_t index);
 
+    /* Looks up the nodes at a sorted (non-decreasing) bidirectional range of
+       indices in the subtree rooted at this node, where `base` is subtracted
+       from each index, and writes them to `out` in the same order.  The
+       indices are partitioned at each node, so search paths are traversed
+       only once, and k lookups take O(k log(N/k)) time instead of O(k log N). */
+    template<class IndexIterator, class OutputIterator>
+    OutputIterator at_many( IndexIterator first, IndexIterator last,
+                            OutputIterator out, size_t base = 0 ) const;
+
     /* Removes this node from its tree, probabilistically merging its children
        into a new subtree to replace it, and returns the new root of the tree,
        which is different from the old root if this node was the old root. */
     template<class RNG>
-    RbstNode *erase(RNG &rng);
+    RbstNode *erase(RNG &rng) { RbstNoUpdate update; return erase(rng, update); }
 
     /* Inserts this node in the subtree at `node` with parent `parent`.
        Returs the new  root of the subtree, which is either `this` or `node`,
@@ -67,15 +118,93 @@ public:
        of its subtree. */
     template<class NodeCompare, class RNG>
     RbstNode *insert( RbstNode *node, RbstNode *parent,
-                      NodeCompare &compare, RNG &rng );
+                      NodeCompare &compare, RNG &rng )
+    {
+        RbstNoUpdate update;
+        return insert(node, parent, compare, rng, update);
+    }
+
+    /* Versions of erase() and insert() that call `update(node)` for every
+       node whose subtree has changed, after its children and size have been
+       updated, in bottom-up order.  This lets derived node types maintain
+       other subtree data than the size (see RbstHashedNode for an example).
+       The topmost node of the tree (the one without a parent) is never
+       updated, since it is assumed to be a sentinel, like RbstTree. */
+    template<class RNG, class Update>
+    RbstNode *erase(RNG &rng, Update &update);
+
+    template<class NodeCompare, class RNG, class Update>
+    RbstNode *insert( RbstNode *node, RbstNode *parent,
+                      NodeCompare &compare, RNG &rng, Update &update );
+
+    /* Weight-balanced versions of erase() and insert().  Nodes are rebalanced
+       up to, but not including, the topmost node of the tree (the one without
+       a parent) which is assumed to be a sentinel, like RbstTree. */
+    template<class Update>
+    RbstNode *erase(RbstWeightBalanced &wb, Update &update);
+
+    template<class NodeCompare, class Update>
+    RbstNode *insert( RbstNode *node, RbstNode *parent, NodeCompare &compare,
+                      RbstWeightBalanced &wb, Update &update );
+
+    /* Inserts this node after all nodes of the subtree at `node` with parent
+       `parent`, and returns the new root of the subtree like insert().  This
+       follows the right spine without comparing values, and works for both
+       random and weight-balanced trees. */
+    template<class RNG, class Update>
+    RbstNode *push_back( RbstNode *node, RbstNode *parent,
+                         RNG &rng, Update &update );
+
+    /* Calls update(node) for this node and all of its ancestors, except the
+       topmost node of the tree, as required after changing data of this node
+       that the update hook depends on (see insert() below). */
+    template<class Update>
+    void update_path(Update &update)
+    {
+        for (RbstNode *node = this; node->m_parent; node = node->m_parent)
+            update(node);
+    }
+    void update_path(RbstNoUpdate &) { }
+
+    /* Splits the subtree rooted at `node` into the subtrees `lesser`, with
+       the first `index` nodes, and `greater`, with the remaining nodes, in
+       O(log N) expected time.  A random binary search tree is split by
+       cutting the search path for the index, which yields random binary
+       search trees again; a weight-balanced tree is split by joining the
+       parts on either side of the path.  The roots of the new subtrees get
+       no parent. */
+    template<class RNG, class Update>
+    static void split_at( RbstNode *node, size_t index, RbstNode *&lesser,
+                          RbstNode *&greater, RNG &rng, Update &update );
+
+    template<class Update>
+    static void split_at( RbstNode *node, size_t index, RbstNode *&lesser,
+                          RbstNode *&greater, RbstWeightBalanced &wb,
+                          Update &update );
+
+    /* Merges the trees `lesser` and `greater`, where the elements of `lesser`
+       are less than (or equal to) the elements of `greater`, and returns the
+       root of the new tree, which is balanced like the old trees.  The parent
+       of the new root must be set by the caller. */
+    template<class RNG, class Update>
+    static RbstNode *join( RbstNode *lesser, RbstNode *greater,
+                           RNG &rng, Update &update );
+
+    template<class Update>
+    static RbstNode *join( RbstNode *lesser, RbstNode *greater,
+                           RbstWeightBalanced &wb, Update &update );
 
 protected:
-    template<class NodeCompare>
-    void split( RbstNode &tree, RbstNode &lesser,
-                                RbstNode &greater, NodeCompare &compare );
+    template<class NodeCompare, class Update>
+    void split( RbstNode &tree, RbstNode &lesser, RbstNode &greater,
+                NodeCompare &compare, Update &update );
 
-    template<class RNG>
-    static RbstNode *join(RbstNode *lesser, RbstNode *greater, RNG &rng);
+    // Helper functions for weight-balanced trees:
+    template<class Update> static RbstNode *rotate_left(RbstNode *node, Update &update);
+    template<class Update> static RbstNode *rotate_right(RbstNode *node, Update &update);
+    template<class Update> static RbstNode *rebalance(RbstNode *node, Update &update);
+    template<class Update> static RbstNode *remove_first(RbstNode *node, Update &update);
+    template<class Update> static RbstNode *remove_last(RbstNode *node, Update &update);
 
 protected:
     RbstNode *m_left, *m_right, *m_parent;
@@ -104,27 +233,47 @@ const RbstNode *RbstNode::next() const
 
 const RbstNode *RbstNode::offset(ptrdiff_t d) const
 {
-    if (d > 0)
+    // For small offsets, stepping through successors/predecessors is cheaper
+    // than climbing to a common ancestor and descending again:
+    if (d >= -small_offset && d <= small_offset)
     {
-        if (d <= size(m_right))
-            return m_right->offset(d - 1 - size(m_right->m_left));
+        const RbstNode *node = this;
+        for (; d > 0 && node; --d) node = node->next();
+        for (; d < 0 && node; ++d) node = node->previous();
+        return node;
     }
-    else
-    if (d < 0)
+
+    // Climb until the target lies within the subtree rooted at `node`; `i`
+    // is then its index relative to the first node in that subtree.
+    const RbstNode *node = this;
+    ptrdiff_t i = (ptrdiff_t)size(m_left) + d;
+    while (i < 0 || i >= (ptrdiff_t)node->m_size)
     {
-        if (-d <= size(m_left))
-            return m_left->offset(d + 1 + size(m_left->m_right));
+        const RbstNode *parent = node->m_parent;
+        if (!parent) return NULL;
+        if (node == parent->m_right) i += 1 + size(parent->m_left);
+        node = parent;
     }
-    else
+
+    // Descend to the target node:
+    for (;;)
     {
-        return this;  // d == 0
+        ptrdiff_t n = (ptrdiff_t)size(node->m_left);
+        if (i < n)
+        {
+            node = node->m_left;
+        }
+        else
+        if (i > n)
+        {
+            node = node->m_right;
+            i -= n + 1;
+        }
+        else
+        {
+            return node;
+        }
     }
-
-    if (!m_parent)
-        return NULL;
-
-    return m_parent->offset( this == m_parent->m_left ? d - 1 - size(m_right)
-                                                      : d + 1 + size(m_left) );
 }
 
 size_t RbstNode::index() const
@@ -146,22 +295,54 @@ RbstNode *RbstNode::at(size_t index)
          : this;
 }
 
+template<class IndexIterator, class OutputIterator>
+OutputIterator RbstNode::at_many( IndexIterator first, IndexIterator last,
+                                  OutputIterator out, size_t base ) const
+{
+    if (first == last) return out;
+
+    // Descend while all indices are on the same side of the current node:
+    const RbstNode *node = this;
+    IndexIterator back = last;
+    --back;
+    size_t index;
+    for (;;)
+    {
+        index = base + size(node->m_left);
+        if (*back < index)
+            node = node->m_left;
+        else
+        if (*first > index)
+            node = node->m_right, base = index + 1;
+        else
+            break;
+    }
+
+    // Partition the indices at this node:
+    IndexIterator mid = std::lower_bound(first, last, index),
+                  end = std::upper_bound(mid, last, index);
+    if (first != mid) out = node->m_left->at_many(first, mid, out, base);
+    for (; mid != end; ++mid) *out++ = node;
+    if (end != last) out = node->m_right->at_many(end, last, out, index + 1);
+    return out;
+}
+
 /* Splits the given `tree`.  Nodes in the tree are attached into lesser/greater
    depending on how they compare to the current node.
 
    When called, lesser->m_right and greater->m_left are uninitialized and will
    be updated by this function.
 */
-template<class NodeCompare>
-void RbstNode::split( RbstNode &tree, RbstNode &lesser,
-                                      RbstNode &greater, NodeCompare &compare )
+template<class NodeCompare, class Update>
+void RbstNode::split( RbstNode &tree, RbstNode &lesser, RbstNode &greater,
+                      NodeCompare &compare, Update &update )
 {
     if (compare(this, &tree))
     {
         greater.m_left = &tree;
         tree.m_parent  = &greater;
         if (tree.m_left)
-            split(*tree.m_left, lesser, tree, compare);
+            split(*tree.m_left, lesser, tree, compare, update);
         else
             lesser.m_right = NULL;
     }
@@ -170,16 +351,17 @@ void RbstNode::split( RbstNode &tree, RbstNode &lesser,
         lesser.m_right = &tree;
         tree.m_parent  = &lesser;
         if (tree.m_right)
-            split(*tree.m_right, tree, greater, compare);
+            split(*tree.m_right, tree, greater, compare, update);
         else
             greater.m_left = NULL;
     }
     tree.m_size = 1 + size(tree.m_left) + size(tree.m_right);
+    update(&tree);
 }
 
-template<class NodeCompare, class RNG>
+template<class NodeCompare, class RNG, class Update>
 RbstNode *RbstNode::insert( RbstNode *node, RbstNode *parent,
-                            NodeCompare &compare, RNG &rng )
+                            NodeCompare &compare, RNG &rng, Update &update )
 {
     if (!node || rng(1 + node->size()) == 0)
     {
@@ -192,31 +374,47 @@ RbstNode *RbstNode::insert( RbstNode *node, RbstNode *parent,
         }
         else
         {
-            split(*node, *this, *this, compare);
+            split(*node, *this, *this, compare, update);
             std::swap(m_left, m_right);
             m_size = 1 + size(m_left) + size(m_right);
         }
         m_parent = parent;
+        update(this);
         return this;
     }
     else
     {
         // Insert in left/right subtree.
         if (compare(this, node))
-            node->m_left = insert(node->m_left, node, compare, rng);
+            node->m_left = insert(node->m_left, node, compare, rng, update);
         else
-            node->m_right = insert(node->m_right, node, compare, rng);
+            node->m_right = insert(node->m_right, node, compare, rng, update);
         ++node->m_size;
+        update(node);
         return node;
     }
 }
 
+// Orders any node after all others, to push_back() by insertion:
+struct RbstAppendCompare
+{
+    bool operator()(RbstNode *, RbstNode *) const { return false; }
+};
+
+template<class RNG, class Update>
+RbstNode *RbstNode::push_back( RbstNode *node, RbstNode *parent,
+                               RNG &rng, Update &update )
+{
+    RbstAppendCompare compare;
+    return insert(node, parent, compare, rng, update);
+}
+
 /* Probabilistically merges two random binary search trees, `lesser` and
    `greater`, where the elements of `lesser` are less than (or equal to) the
    elements of `greater`.  The result is another random binary search tree. */
-template<class RNG>
-RbstNode *RbstNode::join( RbstNode *lesser,
-                          RbstNode *greater, RNG &rng )
+template<class RNG, class Update>
+RbstNode *RbstNode::join( RbstNode *lesser, RbstNode *greater,
+                          RNG &rng, Update &update )
 {
     if (!lesser) return greater;
     if (!greater) return lesser;
@@ -224,24 +422,55 @@ RbstNode *RbstNode::join( RbstNode *lesser,
     if (rng(lesser->m_size + greater->m_size) < lesser->m_size)
     {
         lesser->m_size += size(greater);
-        lesser->m_right = join(lesser->m_right, greater, rng);
+        lesser->m_right = join(lesser->m_right, greater, rng, update);
         lesser->m_right->m_parent = lesser;
+        update(lesser);
         return lesser;
     }
     else
     {
         greater->m_size += size(lesser);
-        greater->m_left = join(lesser, greater->m_left, rng);
+        greater->m_left = join(lesser, greater->m_left, rng, update);
         greater->m_left->m_parent = greater;
+        update(greater);
         return greater;
     }
 }
 
-template<class RNG>
-RbstNode *RbstNode::erase(RNG &rng)
+template<class RNG, class Update>
+void RbstNode::split_at( RbstNode *node, size_t index, RbstNode *&lesser,
+                         RbstNode *&greater, RNG &rng, Update &update )
+{
+    if (!node)
+    {
+        lesser = greater = NULL;
+        return;
+    }
+    RbstNode *part;
+    if (index <= size(node->m_left))
+    {
+        split_at(node->m_left, index, lesser, part, rng, update);
+        node->m_left = part;
+        greater = node;
+    }
+    else
+    {
+        split_at( node->m_right, index - size(node->m_left) - 1,
+                  part, greater, rng, update );
+        node->m_right = part;
+        lesser = node;
+    }
+    if (part) part->m_parent = node;
+    node->m_size = 1 + size(node->m_left) + size(node->m_right);
+    update(node);
+    node->m_parent = NULL;
+}
+
+template<class RNG, class Update>
+RbstNode *RbstNode::erase(RNG &rng, Update &update)
 {
     RbstNode *parent = m_parent,
-             *child = join(m_left, m_right, rng);
+             *child = join(m_left, m_right, rng, update);
 
     m_parent = m_left = m_right = NULL;
     m_size = 1;
@@ -263,6 +492,7 @@ RbstNode *RbstNode::erase(RNG &rng)
         --parent->m_size;
         while (parent->m_parent)
         {
+            update(parent);
             parent = parent->m_parent;
             --parent->m_size;
         }
@@ -274,6 +504,232 @@ RbstNode *RbstNode::erase(RNG &rng)
     }
 }
 
+/* Rotates the right child of `node` into its place, and returns it.  The
+   parent pointer of the new subtree root is updated, but the caller must
+   update the corresponding child pointer of the parent node. */
+template<class Update>
+RbstNode *RbstNode::rotate_left(RbstNode *node, Update &update)
+{
+    RbstNode *pivot = node->m_right;
+    node->m_right = pivot->m_left;
+    if (node->m_right) node->m_right->m_parent = node;
+    pivot->m_left   = node;
+    pivot->m_parent = node->m_parent;
+    node->m_parent  = pivot;
+    node->m_size  = 1 + size(node->m_left)  + size(node->m_right);
+    pivot->m_size = 1 + size(pivot->m_left) + size(pivot->m_right);
+    update(node);
+    update(pivot);
+    return pivot;
+}
+
+// Mirror image of rotate_left().
+template<class Update>
+RbstNode *RbstNode::rotate_right(RbstNode *node, Update &update)
+{
+    RbstNode *pivot = node->m_left;
+    node->m_left = pivot->m_right;
+    if (node->m_left) node->m_left->m_parent = node;
+    pivot->m_right  = node;
+    pivot->m_parent = node->m_parent;
+    node->m_parent  = pivot;
+    node->m_size  = 1 + size(node->m_left)  + size(node->m_right);
+    pivot->m_size = 1 + size(pivot->m_left) + size(pivot->m_right);
+    update(node);
+    update(pivot);
+    return pivot;
+}
+
+/* Restores the weight-balance invariant at `node`, assuming its subtrees are
+   balanced and their sizes differ by at most one element from a balanced
+   state, and returns the new root of the subtree (see rotate_left()).  The
+   nodes of the new subtree root and its children are updated. */
+template<class Update>
+RbstNode *RbstNode::rebalance(RbstNode *node, Update &update)
+{
+    size_t l = size(node->m_left), r = size(node->m_right);
+    if (r > RbstWeightBalanced::delta*l && l + r > 1)
+    {
+        RbstNode *right = node->m_right;
+        if (size(right->m_left) >= RbstWeightBalanced::ratio*size(right->m_right))
+            node->m_right = rotate_right(right, update);
+        return rotate_left(node, update);
+    }
+    if (l > RbstWeightBalanced::delta*r && l + r > 1)
+    {
+        RbstNode *left = node->m_left;
+        if (size(left->m_right) >= RbstWeightBalanced::ratio*size(left->m_left))
+            node->m_left = rotate_left(left, update);
+        return rotate_right(node, update);
+    }
+    update(node);
+    return node;
+}
+
+/* Detaches the first node from the weight-balanced subtree rooted at `node`,
+   and returns the new root of the subtree (which may be NULL). */
+template<class Update>
+RbstNode *RbstNode::remove_first(RbstNode *node, Update &update)
+{
+    if (!node->m_left)
+    {
+        RbstNode *right = node->m_right;
+        if (right) right->m_parent = node->m_parent;
+        return right;
+    }
+    node->m_left = remove_first(node->m_left, update);
+    if (node->m_left) node->m_left->m_parent = node;
+    --node->m_size;
+    return rebalance(node, update);
+}
+
+// Mirror image of remove_first().
+template<class Update>
+RbstNode *RbstNode::remove_last(RbstNode *node, Update &update)
+{
+    if (!node->m_right)
+    {
+        RbstNode *left = node->m_left;
+        if (left) left->m_parent = node->m_parent;
+        return left;
+    }
+    node->m_right = remove_last(node->m_right, update);
+    if (node->m_right) node->m_right->m_parent = node;
+    --node->m_size;
+    return rebalance(node, update);
+}
+
+/* Merges two weight-balanced trees, `lesser` and `greater`, where the elements
+   of `lesser` are less than (or equal to) the elements of `greater`.  If the
+   trees differ too much in size, the smaller one is merged into the spine of
+   the larger one; otherwise, the last node of `lesser` or the first node of
+   `greater` (whichever tree is larger) becomes the new root. */
+template<class Update>
+RbstNode *RbstNode::join( RbstNode *lesser, RbstNode *greater,
+                          RbstWeightBalanced &wb, Update &update )
+{
+    if (!lesser) return greater;
+    if (!greater) return lesser;
+
+    if (greater->m_size > RbstWeightBalanced::delta*lesser->m_size)
+    {
+        greater->m_size += lesser->m_size;
+        greater->m_left = join(lesser, greater->m_left, wb, update);
+        greater->m_left->m_parent = greater;
+        return rebalance(greater, update);
+    }
+    if (lesser->m_size > RbstWeightBalanced::delta*greater->m_size)
+    {
+        lesser->m_size += greater->m_size;
+        lesser->m_right = join(lesser->m_right, greater, wb, update);
+        lesser->m_right->m_parent = lesser;
+        return rebalance(lesser, update);
+    }
+
+    RbstNode *root;
+    if (lesser->m_size > greater->m_size)
+    {
+        root = const_cast<RbstNode*>(lesser->last());
+        lesser = remove_last(lesser, update);
+    }
+    else
+    {
+        root = const_cast<RbstNode*>(greater->first());
+        greater = remove_first(greater, update);
+    }
+    root->m_left  = lesser;
+    root->m_right = greater;
+    if (lesser) lesser->m_parent = root;
+    if (greater) greater->m_parent = root;
+    root->m_size = 1 + size(lesser) + size(greater);
+    update(root);
+    return root;
+}
+
+template<class Update>
+void RbstNode::split_at( RbstNode *node, size_t index, RbstNode *&lesser,
+                         RbstNode *&greater, RbstWeightBalanced &wb,
+                         Update &update )
+{
+    if (!node)
+    {
+        lesser = greater = NULL;
+        return;
+    }
+
+    // Detach the node, and join it with the subtree on the other side:
+    RbstNode *left = node->m_left, *right = node->m_right;
+    node->m_left = node->m_right = NULL;
+    node->m_size = 1;
+    update(node);
+    if (index <= size(left))
+    {
+        if (right) right->m_parent = NULL;
+        split_at(left, index, lesser, greater, wb, update);
+        greater = join(join(greater, node, wb, update), right, wb, update);
+    }
+    else
+    {
+        if (left) left->m_parent = NULL;
+        split_at(right, index - size(left) - 1, lesser, greater, wb, update);
+        lesser = join(left, join(node, lesser, wb, update), wb, update);
+    }
+    if (lesser) lesser->m_parent = NULL;
+    if (greater) greater->m_parent = NULL;
+}
+
+template<class Update>
+RbstNode *RbstNode::erase(RbstWeightBalanced &wb, Update &update)
+{
+    RbstNode *parent = m_parent,
+             *child = join(m_left, m_right, wb, update);
+
+    m_parent = m_left = m_right = NULL;
+    m_size = 1;
+
+    if (child) child->m_parent = parent;
+    if (!parent) return child;
+
+    if (parent->m_left == this)
+        parent->m_left = child;
+    else
+        parent->m_right = child;
+
+    // Adjust size of all nodes from parent to root, rebalancing as we go:
+    for (;;)
+    {
+        --parent->m_size;
+        RbstNode *grandparent = parent->m_parent;
+        if (!grandparent) return parent;
+        if (grandparent->m_left == parent)
+            grandparent->m_left = rebalance(parent, update);
+        else
+            grandparent->m_right = rebalance(parent, update);
+        parent = grandparent;
+    }
+}
+
+template<class NodeCompare, class Update>
+RbstNode *RbstNode::insert( RbstNode *node, RbstNode *parent, NodeCompare &compare,
+                            RbstWeightBalanced &wb, Update &update )
+{
+    if (!node)
+    {
+        m_left   = NULL;
+        m_right  = NULL;
+        m_parent = parent;
+        m_size   = 1;
+        update(this);
+        return this;
+    }
+    if (compare(this, node))
+        node->m_left = insert(node->m_left, node, compare, wb, update);
+    else
+        node->m_right = insert(node->m_right, node, compare, wb, update);
+    ++node->m_size;
+    return rebalance(node, update);
+}
+
 /* An RbstValuedNode extends an RbstNode instance with a value of type V.
    As an extra requirement, the children of an RbstValuedNode<V> must also be
    RbstValuednode<V>s. */
@@ -287,6 +743,14 @@ public:
 
     const V &value() const { return m_value; }
 
+    /* Changes the value of this node.  The caller must ensure that the tree
+       remains ordered, and call update_path() if the node type keeps data
+       which depends on the value. */
+    void set_value(const V &value) { m_value = value; }
+
+    // Update hook to pass to the tree algorithms (see RbstNode::insert()).
+    typedef RbstNoUpdate update_type;
+
     // Access methods for left/right subtree pointers, as pointers to
     // RbstValuedNode<V> rather than RbstNode.
     const RbstValuedNode* left() const  { return static_cast<const RbstValuedNode*>(m_left); }
@@ -314,10 +778,108 @@ public:
     static inline const RbstNode *upper_bound( const RbstValuedNode *node,
             const V &value, Comparator &comp, const RbstNode *res = NULL );
 
+    /* Writes the rank of each key in a sorted bidirectional range to `out`:
+       the number of values in the subtree rooted at `node` less than the key,
+       plus `base`.  This is the index of lower_bound(key), but the keys are
+       partitioned at each node like in RbstNode::at_many(), so the search
+       paths are traversed once for all keys. */
+    template<class KeyIterator, class Comparator, class OutputIterator>
+    static OutputIterator rank_many( const RbstValuedNode *node,
+        KeyIterator first, KeyIterator last, Comparator &comp,
+        OutputIterator out, size_t base = 0 );
+
+    /* Returns the number of values that occur in both of the subtrees rooted
+       at `a` and `b`.  The subtree at `a` is traversed recursively, while the
+       part of `b` that may contain values of the current subtree of `a` is
+       narrowed down along the way; subtrees of `a` for which this part is
+       empty are skipped entirely.  Nothing is modified or allocated, and the
+       running time is O(|a| log |b|) at worst, but much less if the values of
+       the two subtrees are clustered.  Call this with `a` the smaller tree. */
+    template<class Comparator>
+    static size_t count_common( const RbstValuedNode *a,
+        const RbstValuedNode *b, Comparator &comp,
+        const V *lo = NULL, const V *hi = NULL );
+
+    /* Copies the values in the subtree rooted at `node` in order to `out`,
+       and returns the end of the output range.  The tree is traversed using
+       an explicit stack rather than parent pointers. */
+    template<class OutputIterator>
+    static OutputIterator copy(const RbstValuedNode *node, OutputIterator out);
+
 protected:
     V m_value;
 };
 
+template<class V> template<class OutputIterator>
+OutputIterator RbstValuedNode<V>::copy( const RbstValuedNode<V> *node,
+                                        OutputIterator out )
+{
+    std::vector<const RbstValuedNode<V>*> stack;
+    for (;;)
+    {
+        for (; node; node = node->left()) stack.push_back(node);
+        if (stack.empty()) return out;
+        node = stack.back();
+        stack.pop_back();
+        *out++ = node->value();
+        node = node->right();
+    }
+}
+
+
+template<class V>
+template<class KeyIterator, class Comparator, class OutputIterator>
+OutputIterator RbstValuedNode<V>::rank_many( const RbstValuedNode<V> *node,
+    KeyIterator first, KeyIterator last, Comparator &comp,
+    OutputIterator out, size_t base )
+{
+    if (first == last) return out;
+    KeyIterator back = last; --back;
+    for (; node; node = node->left())
+    {
+        // Descend without partitioning while all keys go the same way:
+        while (node && comp(node->value(), *first))
+        {
+            base += size(node->m_left) + 1;
+            node = node->right();
+        }
+        if (!node || comp(node->value(), *back)) break;
+    }
+    if (!node)
+    {
+        for (; first != last; ++first) *out++ = base;
+        return out;
+    }
+    KeyIterator mid = std::upper_bound(first, last, node->value(), comp);
+    out = rank_many(node->left(), first, mid, comp, out, base);
+    return rank_many( node->right(), mid, last, comp, out,
+                      base + size(node->m_left) + 1 );
+}
+
+template<class V> template<class Comparator>
+size_t RbstValuedNode<V>::count_common( const RbstValuedNode<V> *a,
+    const RbstValuedNode<V> *b, Comparator &comp, const V *lo, const V *hi )
+{
+    size_t res = 0;
+    for (; a; lo = &a->value(), a = a->right())
+    {
+        // Narrow down `b` to the subtree containing all values in (lo, hi):
+        while (b)
+        {
+            if (lo && !comp(*lo, b->value()))
+                b = b->right();
+            else
+            if (hi && !comp(b->value(), *hi))
+                b = b->left();
+            else
+                break;
+        }
+        if (!b) break;
+        if (find(b, a->value(), comp)) ++res;
+        res += count_common(a->left(), b, comp, lo, &a->value());
+    }
+    return res;
+}
 
 template<class V> template<class Comparator>
 const RbstNode *RbstValuedNode<V>::find( const RbstValuedNode<V> *node,
@@ -378,9 +940,24 @@ public:
 
     template<class RNG>
     void insert(RbstValuedNode<V> &node, RNG &rng)
+    {
+        RbstNoUpdate update;
+        insert(node, rng, update);
+    }
+
+    template<class RNG, class Update>
+    void insert(RbstValuedNode<V> &node, RNG &rng, Update &update)
     {
         ++m_size;
-        m_left = node.insert(m_left, this, *this, rng);
+        m_left = node.insert(m_left, this, *this, rng, update);
+    }
+
+    // Inserts `node` after all nodes of the tree; see RbstNode::push_back().
+    template<class RNG, class Update>
+    void push_back(RbstValuedNode<V> &node, RNG &rng, Update &update)
+    {
+        ++m_size;
+        m_left = node.push_back(m_left, this, rng, update);
     }
 
     // RbstNode comparator.  This allows the tree to be used as the comparison
@@ -420,6 +997,12 @@ public:
     const RbstNode *lower_bound(const V &v) const { return RbstValuedNode<V>::lower_bound(root(), v, m_comp, this); }
     const RbstNode *upper_bound(const V &v) const { return RbstValuedNode<V>::upper_bound(root(), v, m_comp, this); }
 
+    template<class KeyIterator, class OutputIterator>
+    OutputIterator rank_many(KeyIterator first, KeyIterator last, OutputIterator out) const
+    {
+        return RbstValuedNode<V>::rank_many(root(), first, last, m_comp, out);
+    }
+
 private:
     Comparator m_comp;
 };
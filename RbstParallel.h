@@ -0,0 +1,127 @@
+#ifndef RBST_PARALLEL_H_INCLUDED
+#define RBST_PARALLEL_H_INCLUDED
+
+#include <cstddef>
+#include <algorithm>
+#include <vector>
+
+#if __cplusplus >= 201103L
+#include <atomic>
+#include <exception>
+#include <thread>
+#endif
+
+// Minimal support for running independent tasks in parallel, used by the bulk
+// operations of RbstSet.  This requires C++11 (std::thread); when compiled as
+// C++98, tasks are simply run one after another in the calling thread.
+
+// Returns the number of hardware threads available (at least 1).
+inline unsigned rbst_hardware_threads()
+{
+#if __cplusplus >= 201103L
+    unsigned n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+#else
+    return 1;
+#endif
+}
+
+/* Calls task(i) for 0 <= i < n, using up to `threads` threads (including the
+   calling thread), and returns when all tasks are done.  Tasks are handed out
+   one at a time, so they need not be of equal size.  If a task (or starting a
+   thread) throws, no more tasks are started, and one of the exceptions is
+   rethrown after all threads have finished. */
+template<class Task>
+void rbst_parallel_for(size_t n, unsigned threads, Task &task)
+{
+#if __cplusplus >= 201103L
+    if (threads > n) threads = (unsigned)n;
+    if (threads > 1)
+    {
+        std::atomic<size_t> next(0);
+        std::vector<std::exception_ptr> errors(threads);
+        auto worker = [&](unsigned t) {
+            try
+            {
+                for (size_t i; (i = next.fetch_add(1)) < n; ) task(i);
+            }
+            catch (...)
+            {
+                errors[t] = std::current_exception();
+                next.store(n);
+            }
+        };
+        std::vector<std::thread> pool;
+        try
+        {
+            pool.reserve(threads - 1);
+            for (unsigned t = 1; t < threads; ++t) pool.emplace_back(worker, t);
+        }
+        catch (...)
+        {
+            errors[0] = std::current_exception();
+            next.store(n);
+        }
+        if (!errors[0]) worker(0);
+        for (size_t t = 0; t < pool.size(); ++t) pool[t].join();
+        for (size_t t = 0; t < errors.size(); ++t)
+            if (errors[t]) std::rethrow_exception(errors[t]);
+        return;
+    }
+#else
+    (void)threads;
+#endif
+    for (size_t i = 0; i < n; ++i) task(i);
+}
+
+// Task for rbst_parallel_stable_sort(), which sorts or merges chunks.
+template<class RandomAccessIterator, class Compare>
+struct RbstSortTask
+{
+    RbstSortTask(const std::vector<RandomAccessIterator> &bounds, Compare comp)
+        : bounds(bounds), comp(comp), width(0) { }
+
+    void operator()(size_t i)
+    {
+        if (width == 0)
+        {
+            std::stable_sort(bounds[i], bounds[i + 1], comp);
+        }
+        else
+        {
+            size_t mid = (2*i + 1)*width, last = std::min(mid + width, bounds.size() - 1);
+            std::inplace_merge(bounds[2*i*width], bounds[mid], bounds[last], comp);
+        }
+    }
+
+    const std::vector<RandomAccessIterator> &bounds;
+    Compare comp;
+    size_t width;
+};
+
+/* Sorts [first, last) like std::stable_sort(), using up to `threads` threads.
+   The range is divided into chunks that are sorted in parallel, after which
+   adjacent chunks are merged pairwise (again in parallel) until one remains. */
+template<class RandomAccessIterator, class Compare>
+void rbst_parallel_stable_sort( RandomAccessIterator first,
+    RandomAccessIterator last, Compare comp, unsigned threads )
+{
+    const size_t min_chunk = 8192;
+    size_t n = last - first, chunks = std::min<size_t>(threads, n/min_chunk);
+    if (chunks <= 1)
+    {
+        std::stable_sort(first, last, comp);
+        return;
+    }
+    std::vector<RandomAccessIterator> bounds;
+    for (size_t i = 0; i <= chunks; ++i) bounds.push_back(first + n*i/chunks);
+    RbstSortTask<RandomAccessIterator, Compare> task(bounds, comp);
+    rbst_parallel_for(chunks, threads, task);
+    for (task.width = 1; task.width < chunks; task.width *= 2)
+    {
+        size_t merges = (chunks + task.width - 1)/(2*task.width);
+        rbst_parallel_for(merges, threads, task);
+    }
+}
+
+#endif  /* ndef RBST_PARALLEL_H_INCLUDED */
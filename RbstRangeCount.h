@@ -0,0 +1,262 @@
+#ifndef RBST_RANGE_COUNT_H_INCLUDED
+#define RBST_RANGE_COUNT_H_INCLUDED
+
+#include "RbstCountedMultiset.h"
+#include "RbstSet.h"
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <utility>
+
+/* An RbstPointNode holds a point (x, y), and keeps the y-coordinates of all
+   points in its subtree in an RbstCountedMultiset, so that the points of a
+   subtree with y in a given range can be counted in O(log N) time.
+
+   The update hook rebuilds the multiset from those of the children (in
+   O(S log S) time, for a subtree of S nodes) only if its size differs from
+   the subtree size.  Restructuring (splits and joins) changes subtrees only
+   by removing or by adding points, which always changes their size, while
+   the nodes on the path of an insertion or erasure are expected to have
+   been given the new y-coordinate (or have it removed) beforehand; see
+   RbstRangeCounter.  In a random binary search tree, a subtree of S nodes
+   is restructured with probability O(1/S) per update, so this takes
+   O(log^2 N) expected time per update. */
+template<class X, class Y>
+class RbstPointNode : public RbstValuedNode<std::pair<X, Y> >
+{
+public:
+    RbstPointNode( const std::pair<X, Y> &value, RbstNode *left = NULL,
+                   RbstNode *right = NULL, RbstNode *parent = NULL )
+        : RbstValuedNode<std::pair<X, Y> >(value, left, right, parent)
+    {
+        update_type()(this);
+    }
+
+    // Rebuilds the multiset of y-coordinates if it is out of date.
+    struct update_type
+    {
+        void operator()(RbstNode *node) const
+        {
+            RbstPointNode *n = static_cast<RbstPointNode*>(node);
+            if (n->m_ys.size() != n->size()) n->rebuild();
+        }
+    };
+
+    const RbstPointNode* left() const  { return static_cast<const RbstPointNode*>(this->m_left); }
+    const RbstPointNode* right() const { return static_cast<const RbstPointNode*>(this->m_right); }
+
+    // Returns the y-coordinates of the points in the subtree of this node.
+    const RbstCountedMultiset<Y> &ys() const { return m_ys; }
+    RbstCountedMultiset<Y> &ys() { return m_ys; }
+
+    /* Returns the number of points in the subtree rooted at `node` with
+       y in [y1, y2] (i.e. not less than y1 and not greater than y2). */
+    static size_t count_y(const RbstPointNode *node, const Y &y1, const Y &y2)
+    {
+        if (!node || y2 < y1) return 0;
+        const RbstCountedMultiset<Y> &ys = node->m_ys;
+        return ys.rank(y2) + ys.count(y2) - ys.rank(y1);
+    }
+
+    /* Returns the number of points in the subtree rooted at `node` with x not
+       less than x1 (if `upper` is false) or not greater than x1 (if `upper`
+       is true) and y in [y1, y2].  The search path for x1 is followed, and
+       the subtrees on the inner side of it are counted as a whole. */
+    static size_t count_side( const RbstPointNode *node, const X &x1, bool upper,
+                              const Y &y1, const Y &y2 );
+
+    /* Returns the number of points in the subtree rooted at `node` in the
+       rectangle [x1, x2] x [y1, y2], in O(log^2 N) time. */
+    static size_t count_rect( const RbstPointNode *node, const X &x1, const X &x2,
+                              const Y &y1, const Y &y2 );
+
+protected:
+    static bool in_y(const Y &y, const Y &y1, const Y &y2) { return !(y < y1) && !(y2 < y); }
+
+    void rebuild()
+    {
+        typedef RbstSetRange<std::pair<Y, size_t> > Entries;
+        m_ys.clear();
+        m_ys.insert(this->value().second);
+        const RbstPointNode *children[2] = { left(), right() };
+        for (int i = 0; i < 2; ++i)
+        {
+            if (!children[i]) continue;
+            Entries entries = children[i]->m_ys.entries();
+            for (typename Entries::iterator it = entries.begin(); it != entries.end(); ++it)
+                m_ys.insert(it->first, it->second);
+        }
+    }
+
+    RbstCountedMultiset<Y> m_ys;
+};
+
+template<class X, class Y>
+size_t RbstPointNode<X, Y>::count_side( const RbstPointNode *node, const X &x1, bool upper,
+                                        const Y &y1, const Y &y2 )
+{
+    size_t res = 0;
+    while (node)
+    {
+        const std::pair<X, Y> &p = node->value();
+        bool inside = upper ? !(x1 < p.first) : !(p.first < x1);
+        if (!inside)
+        {
+            node = upper ? node->left() : node->right();
+            continue;
+        }
+        res += in_y(p.second, y1, y2) + count_y(upper ? node->left() : node->right(), y1, y2);
+        node = upper ? node->right() : node->left();
+    }
+    return res;
+}
+
+template<class X, class Y>
+size_t RbstPointNode<X, Y>::count_rect( const RbstPointNode *node, const X &x1, const X &x2,
+                                        const Y &y1, const Y &y2 )
+{
+    if (x2 < x1) return 0;
+
+    // Find the node where the search paths for x1 and x2 diverge:
+    while (node)
+    {
+        const X &x = node->value().first;
+        if (x < x1)
+            node = node->right();
+        else
+        if (x2 < x)
+            node = node->left();
+        else
+            break;
+    }
+    if (!node) return 0;
+    return in_y(node->value().second, y1, y2) +
+           count_side(node->left(), x1, false, y1, y2) +
+           count_side(node->right(), x2, true, y1, y2);
+}
+
+/* An RbstRangeCounter is a set of points (x, y), ordered by x and then by y,
+   which counts the points in a rectangle [x1, x2] x [y1, y2] in O(log^2 N)
+   time: for example, the events with a time in [t1, t2] and a value <= v.
+   It is a two-level range tree: a random binary search tree on the points,
+   whose nodes keep the y-coordinates of their subtrees in RbstCountedMultisets
+   (see RbstPointNode).  Insertion and erasure take O(log^2 N) expected time,
+   and the structure takes O(N log N) expected space.
+
+   The coordinates are compared with operator<. */
+template< class X, class Y,
+          class Allocator = std::allocator<std::pair<X, Y> >,
+          class Rng = DefaultRng >
+class RbstRangeCounter
+    : protected RbstSet< std::pair<X, Y>, std::less<std::pair<X, Y> >, Allocator, Rng,
+                         RbstPointNode<X, Y> >
+{
+public:
+    typedef std::pair<X, Y> value_type;
+    typedef size_t size_type;
+
+    RbstRangeCounter() { }
+
+    template<class InputIterator>
+    RbstRangeCounter(InputIterator first, InputIterator last) { Set::insert(first, last); }
+
+    bool empty() const { return Set::empty(); }
+    size_type size() const { return Set::size(); }
+    void clear() { Set::clear(); }
+
+    // Returns whether the point (x, y) is in the set (0 or 1).
+    size_type count(const X &x, const Y &y) const { return Set::count(value_type(x, y)); }
+
+    // Returns the number of points in [x1, x2] x [y1, y2].
+    size_type count(const X &x1, const X &x2, const Y &y1, const Y &y2) const
+    {
+        return node_type::count_rect(this->root(), x1, x2, y1, y2);
+    }
+
+    // Returns the number of points in [x1, x2] with y <= y2.
+    size_type count_below(const X &x1, const X &x2, const Y &y2) const
+    {
+        if (empty()) return 0;
+        return node_type::count_rect(this->root(), x1, x2, lowest_y(), y2);
+    }
+
+    /* Replaces the contents with the points in [first, last), which need not
+       be sorted.  The tree is built bottom-up, so that each multiset is built
+       from those of its children. */
+    template<class InputIterator>
+    void assign(InputIterator first, InputIterator last, unsigned threads = 0)
+    {
+        Set::assign(first, last, threads);
+    }
+
+    // Inserts the point (x, y), and returns whether it was not present.  If
+    // this fails before the point is linked into the tree (while adding y to
+    // the multisets on its path, or constructing its node), the multisets are
+    // restored.
+    bool insert(const X &x, const Y &y)
+    {
+        value_type p(x, y);
+        if (Set::count(p)) return false;
+        // The new point will be in the subtrees of the nodes on its search
+        // path, so it is added to their multisets first (and removed again if
+        // inserting fails):
+        const std::less<value_type> comp;
+        size_type added = 0;
+        try
+        {
+            for (node_type *node = mutable_root(); node; ++added)
+            {
+                node->ys().insert(y);
+                node = mutable_child(node, comp(p, node->value()));
+            }
+            Set::insert(p);
+        }
+        catch (...)
+        {
+            node_type *node = mutable_root();
+            for (size_type i = 0; i < added; ++i)
+            {
+                node->ys().erase(y, 1);
+                node = mutable_child(node, comp(p, node->value()));
+            }
+            throw;
+        }
+        return true;
+    }
+
+    // Erases the point (x, y), and returns whether it was present.
+    size_type erase(const X &x, const Y &y)
+    {
+        value_type p(x, y);
+        const_iterator it = Set::find(p);
+        if (it == this->end()) return 0;
+        const std::less<value_type> comp;
+        for (node_type *node = mutable_root(); node != Set::node_of(it); )
+        {
+            node->ys().erase(y, 1);
+            node = mutable_child(node, comp(p, node->value()));
+        }
+        Set::erase(it);
+        return 1;
+    }
+
+    void swap(RbstRangeCounter &that) { Set::swap(that); }
+
+protected:
+    typedef RbstSet< value_type, std::less<value_type>, Allocator, Rng,
+                     RbstPointNode<X, Y> > Set;
+    typedef typename Set::node_type node_type;
+    typedef typename Set::const_iterator const_iterator;
+
+    node_type *mutable_root() { return const_cast<node_type*>(this->root()); }
+
+    static node_type *mutable_child(node_type *node, bool left)
+    {
+        return const_cast<node_type*>(left ? node->left() : node->right());
+    }
+
+    // Returns the least y-coordinate in the set, which must not be empty.
+    const Y &lowest_y() const { return this->root()->ys().at(0); }
+};
+
+#endif  /* ndef RBST_RANGE_COUNT_H_INCLUDED */
@@ -0,0 +1,203 @@
+#ifndef RBST_RANGE_SET_H_INCLUDED
+#define RBST_RANGE_SET_H_INCLUDED
+
+#include "RbstSet.h"
+#include "RbstWeighted.h"
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+// Runs of consecutive integers [lo, hi] (given as a pair), ordered by their
+// first element, and weighted by the number of integers they contain.
+template<class Int>
+struct RbstRunCompare
+{
+    bool operator()(const std::pair<Int, Int> &a, const std::pair<Int, Int> &b) const
+    {
+        return a.first < b.first;
+    }
+};
+
+template<class Int>
+struct RbstRunWeight
+{
+    size_t operator()(const std::pair<Int, Int> &run) const
+    {
+        return (size_t)run.second - (size_t)run.first + 1;
+    }
+};
+
+/* An RbstRangeSet is a set of integers, which is stored as a set of maximal
+   runs of consecutive integers.  Each run takes a single node, which makes
+   sets with long runs (such as allocated IDs, or received sequence numbers)
+   much smaller than an RbstSet<Int>.  Nodes are weighted by the number of
+   integers in their run, so that at() and rank() work on the individual
+   integers in O(log R) expected time, where R is the number of runs.
+   Inserting and erasing integers merges, shrinks or splits runs as needed.
+
+   The runs can be accessed (in order) through runs().  The number of integers
+   in the set must fit in a size_t. */
+template< class Int,
+          class Allocator = std::allocator<std::pair<Int, Int> >,
+          class Rng = DefaultRng >
+class RbstRangeSet
+    : protected RbstSet< std::pair<Int, Int>, RbstRunCompare<Int>, Allocator, Rng,
+                         RbstWeightedNode<std::pair<Int, Int>, RbstRunWeight<Int> > >
+{
+public:
+    typedef Int value_type;
+    typedef std::pair<Int, Int> run_type;
+    typedef size_t size_type;
+
+    RbstRangeSet() { }
+
+    bool empty() const { return Set::empty(); }
+    void clear() { Set::clear(); }
+
+    // Returns the number of integers in the set.
+    size_type size() const { return node_type::weight(this->root()); }
+
+    // Returns the number of runs in the set.
+    size_type run_count() const { return Set::size(); }
+
+    // Returns a view of the runs in the set, in order.
+    RbstSetRange<run_type> runs() const { return Set::range(); }
+
+    // Returns whether `x` is in the set (0 or 1).
+    size_type count(Int x) const
+    {
+        const_iterator it = run_before(x);
+        return it != this->end() && x <= it->second;
+    }
+
+    // Returns the element at index `i`, which must be less than size().
+    Int at(size_type i) const
+    {
+        const node_type *node = node_type::at_weight(this->root(), i);
+        return node->value().first + (Int)i;
+    }
+
+    // Returns the number of elements less than `x` (which is the index of
+    // `x` if it is in the set).
+    size_type rank(Int x) const
+    {
+        size_type res = 0;
+        for (const node_type *node = this->root(); node; )
+        {
+            const run_type &run = node->value();
+            if (x < run.first)
+            {
+                node = node->left();
+                continue;
+            }
+            res += node_type::weight(node->left());
+            if (x <= run.second) return res + (size_type)x - (size_type)run.first;
+            res += RbstRunWeight<Int>()(run);
+            node = node->right();
+        }
+        return res;
+    }
+
+    // Inserts `x`, and returns whether it was not in the set before.
+    bool insert(Int x) { return insert(x, x) > 0; }
+
+    /* Inserts the integers in [lo, hi], merging them with overlapping and
+       adjacent runs, and returns the number of integers added.  If hi < lo,
+       the range is empty, and nothing is inserted. */
+    size_type insert(Int lo, Int hi)
+    {
+        if (hi < lo) return 0;
+        size_type old_size = size();
+
+        // Find the runs [first, last) that overlap or touch [lo, hi]:
+        const_iterator first = run_before(lo), last = Set::upper_bound(run_type(hi, hi));
+        if (first == this->end() || !touches(first->second, lo))
+            first = Set::upper_bound(run_type(lo, lo));
+        if (last != this->end() && touches(hi, last->first)) ++last;
+        if (first == last)
+        {
+            Set::insert(run_type(lo, hi));
+            return (size_type)hi - (size_type)lo + 1;
+        }
+
+        // Extend the first run to cover the others, and erase those:
+        const_iterator back = last;
+        --back;
+        run_type run(std::min(lo, first->first), std::max(hi, back->second));
+        const_iterator next = first;
+        Set::erase(++next, last);
+        set_run(first, run);
+        return size() - old_size;
+    }
+
+    // Erases `x`, and returns whether it was in the set.
+    size_type erase(Int x) { return erase(x, x); }
+
+    /* Erases the integers in [lo, hi], shrinking or splitting the runs that
+       overlap it, and returns the number of integers removed.  If hi < lo,
+       the range is empty, and nothing is erased. */
+    size_type erase(Int lo, Int hi)
+    {
+        if (hi < lo) return 0;
+        size_type old_size = size();
+
+        // Find the runs [first, last) that overlap [lo, hi]:
+        const_iterator first = run_before(lo), last = Set::upper_bound(run_type(hi, hi));
+        if (first == this->end() || first->second < lo)
+            first = Set::upper_bound(run_type(lo, lo));
+        if (first == last) return 0;
+        const_iterator back = last;
+        --back;
+
+        // Keep the parts of the first and last runs outside [lo, hi]:
+        bool single = first == back, keep_right = hi < back->second;
+        run_type right = keep_right ? run_type(hi + 1, back->second) : run_type();
+        if (first->first < lo)
+        {
+            set_run(first, run_type(first->first, lo - 1));
+            ++first;
+        }
+        if (keep_right)
+        {
+            if (single && first != back)
+            {
+                // The run was split in two:
+                Set::insert(right);
+                return old_size - size();
+            }
+            set_run(back, right);
+            last = back;
+        }
+        Set::erase(first, last);
+        return old_size - size();
+    }
+
+    void swap(RbstRangeSet &that) { Set::swap(that); }
+
+protected:
+    typedef RbstSet< run_type, RbstRunCompare<Int>, Allocator, Rng,
+                     RbstWeightedNode<run_type, RbstRunWeight<Int> > > Set;
+    typedef typename Set::node_type node_type;
+    typedef typename Set::const_iterator const_iterator;
+
+    // Returns whether runs ending at `hi` and starting at `lo` can be merged.
+    static bool touches(Int hi, Int lo) { return lo <= hi || lo - 1 == hi; }
+
+    // Returns the last run starting at or before `x`, or end() if none.
+    const_iterator run_before(Int x) const
+    {
+        const_iterator it = Set::upper_bound(run_type(x, x));
+        return it == this->begin() ? this->end() : --it;
+    }
+
+    // Changes the run at `it` (which must remain ordered).
+    void set_run(const_iterator it, const run_type &run)
+    {
+        node_type *node = Set::node_of(it);
+        node->set_value(run);
+        typename node_type::update_type update;
+        node->update_path(update);
+    }
+};
+
+#endif  /* ndef RBST_RANGE_SET_H_INCLUDED */
@@ -0,0 +1,524 @@
+#ifndef RBST_ROPE_H_INCLUDED
+#define RBST_ROPE_H_INCLUDED
+
+#include "RbstSet.h"
+#include <assert.h>
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+
+/* An RbstChunkNode holds a chunk of the bytes of an RbstRope, and keeps the
+   number of bytes and of newline characters in its subtree.  Like the weights
+   of an RbstWeightedNode, these are kept apart from the node count in m_size,
+   by which the tree algorithms balance the tree (and by which the chunks are
+   indexed). */
+class RbstChunkNode : public RbstValuedNode<std::string>
+{
+public:
+    RbstChunkNode( const std::string &chunk, RbstNode *left = NULL,
+                   RbstNode *right = NULL, RbstNode *parent = NULL )
+        : RbstValuedNode<std::string>(chunk, left, right, parent),
+          m_chunk_lines(count_lines(chunk.data(), chunk.size()))
+    {
+        update_type()(this);
+    }
+
+    // Recomputes the subtree totals of a node from its chunk and children.
+    struct update_type
+    {
+        void operator()(RbstNode *node) const
+        {
+            RbstChunkNode *n = static_cast<RbstChunkNode*>(node);
+            n->m_bytes = n->m_value.size() + bytes(n->left()) + bytes(n->right());
+            n->m_lines = n->m_chunk_lines + lines(n->left()) + lines(n->right());
+        }
+    };
+
+    const RbstChunkNode* left() const  { return static_cast<const RbstChunkNode*>(this->m_left); }
+    const RbstChunkNode* right() const { return static_cast<const RbstChunkNode*>(this->m_right); }
+
+    // Returns the number of bytes or newlines in the subtree rooted at `node`
+    // (0 if `node` is NULL).
+    static size_t bytes(const RbstChunkNode *node) { return node ? node->m_bytes : 0; }
+    static size_t lines(const RbstChunkNode *node) { return node ? node->m_lines : 0; }
+
+    // Returns the number of newlines in the chunk of this node.
+    size_t chunk_lines() const { return m_chunk_lines; }
+
+    /* Replaces the `erased` bytes of the chunk at `pos` with the `n` bytes at
+       `data`.  The caller must call update_path() afterwards. */
+    void splice(size_t pos, size_t erased, const char *data, size_t n)
+    {
+        m_chunk_lines -= count_lines(m_value.data() + pos, erased);
+        m_chunk_lines += count_lines(data, n);
+        m_value.replace(pos, erased, data, n);
+    }
+
+    static size_t count_lines(const char *data, size_t n)
+    {
+        return (size_t)std::count(data, data + n, '\n');
+    }
+
+protected:
+    size_t m_bytes, m_lines, m_chunk_lines;
+};
+
+/* An RbstRope is a byte sequence for large, frequently edited texts.  It is
+   stored as a random binary search tree of chunks of at most chunk_size()
+   bytes, ordered by position rather than by a key, whose nodes count the
+   bytes and newlines in their subtrees (see RbstChunkNode).  Positions are
+   byte offsets, which are located by a descent from the root; lines are
+   numbered from 0, and end after each newline character.
+
+   Edits that fit in the chunk at their offset modify it in place.  Other
+   edits cut the tree at the chunk boundaries involved (splitting a chunk in
+   two if an offset falls inside it) and join the parts with a tree built
+   from the new chunks, so that insert(), erase(), split() and concatenation
+   take O(log N + K/C) expected time, where N is the number of chunks, K the
+   number of bytes inserted and C the chunk size.  Neighbouring chunks that
+   fit in one are merged where the tree was cut, which limits fragmentation.
+
+   The chunks can be read in order without copying through chunk_begin()
+   and chunk_end(), or from a given offset through find_chunk(). */
+template< class Allocator = std::allocator<char>,
+          class Rng = DefaultRng >
+class RbstRope
+{
+public:
+    typedef char value_type;
+    typedef size_t size_type;
+    typedef RbstSetIterator<std::string> chunk_iterator;
+
+    static const size_type npos = (size_type)-1;
+
+    explicit RbstRope( size_type chunk_size = 4096,
+                       const Allocator &alloc = Allocator(),
+                       const Rng &rng = Rng() )
+        : m_tree(std::less<std::string>()), m_alloc(alloc), m_rng(rng),
+          m_node_alloc(), m_chunk_size(chunk_size > 0 ? chunk_size : 1) { }
+
+    RbstRope(const RbstRope &that)
+        : m_tree(std::less<std::string>()), m_alloc(that.m_alloc), m_rng(that.m_rng),
+          m_node_alloc(that.m_node_alloc), m_chunk_size(that.m_chunk_size)
+    {
+        m_tree.set_root(clone(that.root()));
+    }
+
+    RbstRope &operator=(const RbstRope &that)
+    {
+        RbstRope copy(that);
+        swap(copy);
+        return *this;
+    }
+
+    ~RbstRope() { clear(); }
+
+    // Returns the number of bytes.
+    size_type size() const { return node_type::bytes(root()); }
+    bool empty() const { return root() == NULL; }
+
+    // Returns the maximum number of bytes per chunk.
+    size_type chunk_size() const { return m_chunk_size; }
+
+    // Returns the number of chunks.
+    size_type chunk_count() const { return RbstNode::size(root()); }
+
+    // Returns the number of lines, i.e. the number of newlines plus one.
+    size_type line_count() const { return node_type::lines(root()) + 1; }
+
+    // Returns the byte at `offset`, which must be less than size().
+    char at(size_type offset) const
+    {
+        const node_type *node = chunk_at(offset);
+        return node->value()[offset];
+    }
+    char operator[](size_type offset) const { return at(offset); }
+
+    // Iterators over the chunks, in order:
+    chunk_iterator chunk_begin() const { return chunk_iterator(m_tree.first()); }
+    chunk_iterator chunk_end() const   { return chunk_iterator(static_cast<const RbstNode*>(&m_tree)); }
+
+    /* Returns the chunk containing the byte at `offset`, and sets `offset` to
+       the position of that byte in the chunk, or returns chunk_end() if
+       offset >= size(). */
+    chunk_iterator find_chunk(size_type &offset) const
+    {
+        const node_type *node = chunk_at(offset);
+        return node ? chunk_iterator(node) : chunk_end();
+    }
+
+    /* Returns a copy of the (up to) `n` bytes at `offset`, which must not be
+       greater than size(). */
+    std::string substr(size_type offset, size_type n = npos) const
+    {
+        assert(offset <= size());
+        n = std::min(n, size() - offset);
+        std::string res;
+        res.reserve(n);
+        for (chunk_iterator it = find_chunk(offset); res.size() < n; ++it, offset = 0)
+            res.append(*it, offset, n - res.size());
+        return res;
+    }
+
+    // Returns the offset of the first byte of line `line`, which must be less
+    // than line_count().
+    size_type line_start(size_type line) const;
+
+    // Returns the line containing the byte at `offset`, i.e. the number of
+    // newlines before it.
+    size_type line_of(size_type offset) const;
+
+    // Inserts the `n` bytes at `data` at `offset`, which must not be greater
+    // than size().
+    void insert(size_type offset, const char *data, size_type n);
+    void insert(size_type offset, const std::string &data) { insert(offset, data.data(), data.size()); }
+
+    /* Moves the contents of `that` into this rope at `offset`, in O(log N)
+       expected time, leaving `that` empty.  The chunks are moved rather than
+       copied, so the node allocators must be equal. */
+    void insert(size_type offset, RbstRope &that)
+    {
+        assert(offset <= size());
+        if (&that == this)
+        {
+            RbstRope copy(that);
+            insert(offset, copy);
+            return;
+        }
+        RbstNode *lesser, *greater, *middle = that.m_tree.left();
+        that.m_tree.set_root(NULL);
+        cut(offset, lesser, greater);
+        join(lesser, middle, greater);
+    }
+
+    // Appends bytes, or the contents of another rope (see insert()):
+    void append(const char *data, size_type n) { insert(size(), data, n); }
+    void append(const std::string &data) { insert(size(), data); }
+    void append(RbstRope &that) { insert(size(), that); }
+
+    // Erases the (up to) `n` bytes at `offset`, which must not be greater
+    // than size().
+    void erase(size_type offset, size_type n = npos);
+
+    /* Moves the bytes from `offset` on to `rest` (replacing its contents) in
+       O(log N) expected time, so that this rope keeps the first `offset`
+       bytes.  The node allocators must be equal. */
+    void split(size_type offset, RbstRope &rest)
+    {
+        assert(offset <= size() && &rest != this);
+        rest.clear();
+        RbstNode *lesser, *greater;
+        cut(offset, lesser, greater);
+        m_tree.set_root(static_cast<node_type*>(lesser));
+        rest.m_tree.set_root(static_cast<node_type*>(greater));
+    }
+
+    void clear()
+    {
+        free(static_cast<node_type*>(m_tree.left()));
+        m_tree.set_root(NULL);
+    }
+
+    void swap(RbstRope &that)
+    {
+        m_tree.swap(that.m_tree);
+        std::swap(m_alloc, that.m_alloc);
+        std::swap(m_rng, that.m_rng);
+        std::swap(m_node_alloc, that.m_node_alloc);
+        std::swap(m_chunk_size, that.m_chunk_size);
+    }
+
+    // For debugging:
+    const RbstTree<std::string, std::less<std::string> > &debug_tree() { return m_tree; }
+
+protected:
+    typedef RbstChunkNode node_type;
+    typedef node_type::update_type update_type;
+    typedef typename Allocator::template rebind<node_type>::other node_allocator_type;
+
+    const node_type *root() const { return static_cast<const node_type*>(m_tree.root()); }
+
+    static node_type *mutable_node(const RbstNode *node)
+    {
+        return const_cast<node_type*>(static_cast<const node_type*>(node));
+    }
+
+    /* Returns the chunk containing the byte at `offset`, and sets `offset` to
+       the position of that byte in the chunk, or returns NULL if
+       offset >= size(). */
+    const node_type *chunk_at(size_type &offset) const
+    {
+        for (const node_type *node = root(); node; )
+        {
+            size_type left = node_type::bytes(node->left());
+            if (offset < left)
+            {
+                node = node->left();
+                continue;
+            }
+            offset -= left;
+            if (offset < node->value().size()) return node;
+            offset -= node->value().size();
+            node = node->right();
+        }
+        return NULL;
+    }
+
+    // Returns the chunk at index `i`, which must be less than chunk_count().
+    node_type *chunk_node(size_type i) { return static_cast<node_type*>(m_tree.left()->at(i)); }
+
+    void update_path(node_type *node)
+    {
+        update_type update;
+        node->update_path(update);
+    }
+
+    /* Makes `offset` a chunk boundary, by splitting the chunk containing it
+       if necessary, and returns the number of chunks before it. */
+    size_type boundary(size_type offset)
+    {
+        size_type pos = offset;
+        const node_type *found = chunk_at(pos);
+        if (!found) return chunk_count();
+        node_type *node = mutable_node(found);
+        size_type index = node->index();
+        if (pos == 0) return index;
+        node_type *tail = create(node->value().substr(pos));
+        node->splice(pos, node->value().size() - pos, "", 0);
+        update_path(node);
+        RbstNode *lesser, *greater;
+        split_at(index + 1, lesser, greater);
+        concat(lesser, tail, greater);
+        return index + 1;
+    }
+
+    // Detaches the tree, and splits it into the first `index` chunks and the others.
+    void split_at(size_type index, RbstNode *&lesser, RbstNode *&greater)
+    {
+        update_type update;
+        RbstNode::split_at(m_tree.left(), index, lesser, greater, m_rng, update);
+        m_tree.set_root(NULL);
+    }
+
+    // Detaches the tree, and splits it into the bytes before `offset` and the others.
+    void cut(size_type offset, RbstNode *&lesser, RbstNode *&greater)
+    {
+        split_at(boundary(offset), lesser, greater);
+    }
+
+    // Makes the concatenation of the detached trees `lesser`, `middle` and
+    // `greater` the tree of this rope.
+    void concat(RbstNode *lesser, RbstNode *middle, RbstNode *greater)
+    {
+        update_type update;
+        RbstNode *root = RbstNode::join(lesser, middle, m_rng, update);
+        root = RbstNode::join(root, greater, m_rng, update);
+        m_tree.set_root(static_cast<node_type*>(root));
+    }
+
+    // Like concat(), but merges small chunks at the seams afterwards.
+    void join(RbstNode *lesser, RbstNode *middle, RbstNode *greater)
+    {
+        size_type first = RbstNode::size(lesser), second = first + RbstNode::size(middle);
+        concat(lesser, middle, greater);
+        coalesce(second);
+        coalesce(first);
+    }
+
+    // Merges chunks `i` - 1 and `i` if they fit in a single chunk.
+    void coalesce(size_type i)
+    {
+        if (i == 0 || i >= chunk_count()) return;
+        node_type *next = chunk_node(i), *prev = mutable_node(next->previous());
+        const std::string &chunk = next->value();
+        if (prev->value().size() + chunk.size() > m_chunk_size) return;
+        prev->splice(prev->value().size(), 0, chunk.data(), chunk.size());
+        update_path(prev);
+        update_type update;
+        next->erase(m_rng, update);
+        destroy(next);
+    }
+
+    /* Builds a random tree from the `n` bytes at `data`, in chunks of nearly
+       equal size, in O(K) time. */
+    node_type *build(const char *data, size_type n)
+    {
+        size_type k = (n + m_chunk_size - 1)/m_chunk_size;
+        return build(data, n, k, 0, k, NULL);
+    }
+
+    // Builds the subtree of chunks [lo, hi) of `k` chunks.
+    node_type *build( const char *data, size_type n, size_type k,
+                      size_type lo, size_type hi, node_type *parent )
+    {
+        if (lo == hi) return NULL;
+        size_type mid = lo + m_rng(hi - lo),
+                  begin = mid*(n/k) + std::min(mid, n%k),
+                  end = begin + n/k + (mid < n%k);
+        node_type *node = m_node_alloc.allocate(1);
+        node_type *left = build(data, n, k, lo, mid, node),
+                  *right = build(data, n, k, mid + 1, hi, node);
+        new (node) node_type(std::string(data + begin, end - begin), left, right, parent);
+        return node;
+    }
+
+    node_type *create(const std::string &chunk)
+    {
+        node_type *node = m_node_alloc.allocate(1);
+        new (node) node_type(chunk);
+        return node;
+    }
+
+    void destroy(node_type *node)
+    {
+        node->~node_type();
+        m_node_alloc.deallocate(node, 1);
+    }
+
+    /* Returns a deep copy of a the subtree rooted at `node`, and sets the
+       parent of the new root node (if not NULL) to `parent`. */
+    node_type *clone(const node_type *node, node_type *parent = NULL)
+    {
+        if (!node) return NULL;
+        node_type *copy = m_node_alloc.allocate(1);
+        new (copy) node_type( node->value(), clone(node->left(), copy),
+                              clone(node->right(), copy), parent );
+        return copy;
+    }
+
+    // Frees all nodes in the subtree rooted at `node`.
+    void free(node_type *node)
+    {
+        if (!node) return;
+        free(const_cast<node_type*>(node->left()));
+        free(const_cast<node_type*>(node->right()));
+        destroy(node);
+    }
+
+    RbstTree<std::string, std::less<std::string> > m_tree;   // not ordered by value
+    Allocator           m_alloc;
+    Rng                 m_rng;
+    node_allocator_type m_node_alloc;
+    size_type           m_chunk_size;
+};
+
+template<class Allocator, class Rng>
+size_t RbstRope<Allocator, Rng>::line_start(size_type line) const
+{
+    assert(line < line_count());
+    if (line == 0) return 0;
+
+    // Find the chunk containing newline number `line` - 1 (counting from 0):
+    size_type k = line - 1, offset = 0;
+    const node_type *node = root();
+    for (;;)
+    {
+        size_type left = node_type::lines(node->left());
+        if (k < left)
+        {
+            node = node->left();
+            continue;
+        }
+        k -= left;
+        offset += node_type::bytes(node->left());
+        if (k < node->chunk_lines()) break;
+        k -= node->chunk_lines();
+        offset += node->value().size();
+        node = node->right();
+    }
+    const char *data = node->value().data(), *p = data;
+    for (;; ++p)
+    {
+        if (*p == '\n' && k-- == 0) break;
+    }
+    return offset + (size_type)(p - data) + 1;
+}
+
+template<class Allocator, class Rng>
+size_t RbstRope<Allocator, Rng>::line_of(size_type offset) const
+{
+    size_type res = 0;
+    for (const node_type *node = root(); node; )
+    {
+        size_type left = node_type::bytes(node->left());
+        if (offset < left)
+        {
+            node = node->left();
+            continue;
+        }
+        offset -= left;
+        res += node_type::lines(node->left());
+        if (offset < node->value().size())
+            return res + node_type::count_lines(node->value().data(), offset);
+        offset -= node->value().size();
+        res += node->chunk_lines();
+        node = node->right();
+    }
+    return res;
+}
+
+template<class Allocator, class Rng>
+void RbstRope<Allocator, Rng>::insert(size_type offset, const char *data, size_type n)
+{
+    assert(offset <= size());
+    if (n == 0) return;
+
+    // Insert into the chunk at `offset` (or the last chunk, at the end) in
+    // place if it has room:
+    size_type pos = offset;
+    node_type *node = NULL;
+    if (offset < size())
+    {
+        node = mutable_node(chunk_at(pos));
+    }
+    else
+    if (!empty())
+    {
+        node = mutable_node(m_tree.left()->last());
+        pos = node->value().size();
+    }
+    if (node && node->value().size() + n <= m_chunk_size)
+    {
+        node->splice(pos, 0, data, n);
+        update_path(node);
+        return;
+    }
+
+    // Otherwise, cut the tree at `offset`, and join in a tree of new chunks:
+    RbstNode *lesser, *greater;
+    cut(offset, lesser, greater);
+    join(lesser, build(data, n), greater);
+}
+
+template<class Allocator, class Rng>
+void RbstRope<Allocator, Rng>::erase(size_type offset, size_type n)
+{
+    assert(offset <= size());
+    n = std::min(n, size() - offset);
+    if (n == 0) return;
+
+    // Erase within a single chunk in place if it does not become empty:
+    size_type pos = offset;
+    node_type *node = mutable_node(chunk_at(pos));
+    if (pos + n <= node->value().size() && n < node->value().size())
+    {
+        node->splice(pos, n, "", 0);
+        update_path(node);
+        size_type index = node->index();
+        coalesce(index + 1);
+        coalesce(index);
+        return;
+    }
+
+    // Otherwise, cut out the chunks in between, and join the rest:
+    RbstNode *lesser, *middle, *greater;
+    cut(offset + n, middle, greater);
+    m_tree.set_root(static_cast<node_type*>(middle));
+    cut(offset, lesser, middle);
+    free(static_cast<node_type*>(middle));
+    join(lesser, NULL, greater);
+}
+
+#endif  /* ndef RBST_ROPE_H_INCLUDED */
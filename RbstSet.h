@@ -2,13 +2,19 @@
 #define RBST_SET_H_INCLUDED
 
 #include "RbstNode.h"
+#include "RbstParallel.h"
+#include "RbstSort.h"
+#include <assert.h>
 #include <stdint.h>
+#include <string.h>
 #include <algorithm>
 #include <cstddef>
 #include <memory>
 #include <functional>
 #include <iterator>
+#include <limits>
 #include <utility>
+#include <vector>
 
 // For the randomized binary search tree, a random number generator is
 // simply a functor that when passed a number n, generates a number uniformly
@@ -34,7 +40,8 @@ typedef LinearCongruentialGenerator<uint32_t, 1664525, 1013904223> DefaultRng;
 template< class Key,
           class Comparator = std::less<Key>,
           class Allocator = std::allocator<Key>,
-          class Rng = DefaultRng >
+          class Rng = DefaultRng,
+          class Node = RbstValuedNode<Key> >
 class RbstSet;
 
 // Iterator used by RbstSet class; a random-access iterator which is implemented
@@ -88,21 +95,315 @@ private:
     const RbstNode *m_node;
 
     // FIXME: I want to restrict Key to V, but I don't know how to do this!
-    template<class Key, class Comparator, class Allocator, class Rng>
+    template<class Key, class Comparator, class Allocator, class Rng, class Node>
     friend class RbstSet;
+    template<class W> friend struct RbstSetReverseIterator;
 };
 
 template<class V>
 RbstSetIterator<V> operator+(ptrdiff_t n, const RbstSetIterator<V> &it)
     { return it + n; }
 
+// Reverse iterator used by RbstSet class.  Unlike std::reverse_iterator, this
+// refers to the current element directly (rather than to its successor) so
+// dereferencing does not need to step through the tree.  The reverse end is
+// represented by the same sentinel node as the forward end, which is at
+// position -1 rather than N in forward order.
+template<class V>
+struct RbstSetReverseIterator
+{
+    typedef std::random_access_iterator_tag iterator_category;
+    typedef const V value_type;
+    typedef ptrdiff_t difference_type;
+    typedef const V *pointer;
+    typedef const V &reference;
+
+    RbstSetReverseIterator(const RbstNode *n = NULL) : m_node(n) { }
+
+    // Constructs a reverse iterator referring to the element before `it`,
+    // like std::reverse_iterator does.
+    explicit RbstSetReverseIterator(const RbstSetIterator<V> &it)
+        : m_node(previous(it.m_node)) { }
+
+    // Returns the forward iterator referring to the element after this one.
+    RbstSetIterator<V> base() const
+        { return RbstSetIterator<V>(m_node->parent() ? m_node->next() : m_node->first()); }
+
+    // Iterator comparisons:
+    bool operator==(const RbstSetReverseIterator &other) const { return m_node == other.m_node; }
+    bool operator!=(const RbstSetReverseIterator &other) const { return m_node != other.m_node; }
+    bool operator< (const RbstSetReverseIterator &other) const { return position() > other.position(); }
+    bool operator> (const RbstSetReverseIterator &other) const { return position() < other.position(); }
+    bool operator<=(const RbstSetReverseIterator &other) const { return m_node == other.m_node || position() >= other.position(); }
+    bool operator>=(const RbstSetReverseIterator &other) const { return m_node == other.m_node || position() <= other.position(); }
+
+    // Accessing value (const only!)
+    const V &operator* () const  { return static_cast<const RbstValuedNode<V>*>(m_node)->value(); }
+    const V *operator-> () const { return &static_cast<const RbstValuedNode<V>*>(m_node)->value(); }
+
+    RbstSetReverseIterator &operator++ ()      { m_node = previous(m_node); return *this;}
+    RbstSetReverseIterator &operator-- ()      { m_node = next(m_node);     return *this; }
+    RbstSetReverseIterator operator++ (int)    { RbstSetReverseIterator old(m_node); m_node = previous(m_node); return old; }
+    RbstSetReverseIterator operator-- (int)    { RbstSetReverseIterator old(m_node); m_node = next(m_node);     return old; }
+
+    // Iterator difference
+    ptrdiff_t operator-(const RbstSetReverseIterator &other) const
+        { return other.position() - position(); }
+
+    // Scalar addition/subtraction
+    RbstSetReverseIterator &operator+=(ptrdiff_t n) { m_node = offset(m_node, -n); return *this; }
+    RbstSetReverseIterator &operator-=(ptrdiff_t n) { m_node = offset(m_node, +n); return *this; }
+    RbstSetReverseIterator operator+(ptrdiff_t n) const { return RbstSetReverseIterator(offset(m_node, -n)); }
+    RbstSetReverseIterator operator-(ptrdiff_t n) const { return RbstSetReverseIterator(offset(m_node, +n)); }
+
+    const V &operator[] (ptrdiff_t n) const { return *(*this + n); }
+
+protected:
+    // Returns the index of the current node in forward order.
+    ptrdiff_t position() const
+        { return m_node->parent() ? (ptrdiff_t)m_node->index() : -1; }
+
+    // Like RbstNode::previous(), but returns the sentinel instead of NULL
+    // when stepping back from the first node.
+    static const RbstNode *previous(const RbstNode *node)
+    {
+        if (node->left()) return node->left()->last();
+        while (node->parent() && node == node->parent()->left())
+            node = node->parent();
+        return node->parent() ? node->parent() : node;
+    }
+
+    // Like RbstNode::next(), but steps from the sentinel to the first node.
+    static const RbstNode *next(const RbstNode *node)
+        { return node->parent() ? node->next() : node->first(); }
+
+    // Like RbstNode::offset(d), but with the sentinel at position -1.
+    static const RbstNode *offset(const RbstNode *node, ptrdiff_t d)
+    {
+        if (!node->parent())
+            return d == 0 ? node : node->offset(d - (ptrdiff_t)node->size());
+        if (const RbstNode *res = node->offset(d))
+            return res;
+        while (node->parent()) node = node->parent();
+        return node;
+    }
+
+private:
+    const RbstNode *m_node;
+};
+
+template<class V>
+RbstSetReverseIterator<V> operator+(ptrdiff_t n, const RbstSetReverseIterator<V> &it)
+    { return it + n; }
+
+/* Stack of pointers which keeps its first `Inline` entries in the object
+   itself, and only allocates memory for entries beyond those.  Expected tree
+   depths are well below the inline capacity, so copying a stack of search
+   path nodes usually does not allocate. */
+template<class T, size_t Inline = 48>
+class RbstPathStack
+{
+public:
+    RbstPathStack() : m_size(0) { }
+
+    RbstPathStack(const RbstPathStack &other)
+        : m_overflow(other.m_overflow), m_size(other.m_size)
+    {
+        std::copy(other.m_inline, other.m_inline + std::min(m_size, Inline), m_inline);
+    }
+
+    RbstPathStack &operator=(const RbstPathStack &other)
+    {
+        std::copy(other.m_inline, other.m_inline + std::min(other.m_size, Inline), m_inline);
+        m_overflow = other.m_overflow;
+        m_size = other.m_size;
+        return *this;
+    }
+
+    bool empty() const { return m_size == 0; }
+    size_t size() const { return m_size; }
+
+    const T &back() const
+        { return m_size <= Inline ? m_inline[m_size - 1] : m_overflow.back(); }
+
+    void push_back(const T &value)
+    {
+        if (m_size < Inline)
+            m_inline[m_size] = value;
+        else
+            m_overflow.push_back(value);
+        ++m_size;
+    }
+
+    void pop_back()
+    {
+        if (m_size > Inline) m_overflow.pop_back();
+        --m_size;
+    }
+
+private:
+    T               m_inline[Inline];
+    std::vector<T>  m_overflow;     // entries after the first Inline ones
+    size_t          m_size;
+};
+
+// Forward iterator over the elements of an RbstSetRange.  Instead of climbing
+// parent pointers, it keeps an explicit stack of the nodes that remain to be
+// visited (the current node on top), and since the number of elements in the
+// range is known in advance, no key comparisons are needed while iterating.
+// The stack is kept inside the iterator (see RbstPathStack), so copying an
+// iterator takes time proportional to the depth of the tree, but does not
+// allocate memory unless the tree is unusually deep.
+template<class V>
+struct RbstSetRangeIterator
+{
+    typedef std::forward_iterator_tag iterator_category;
+    typedef const V value_type;
+    typedef ptrdiff_t difference_type;
+    typedef const V *pointer;
+    typedef const V &reference;
+
+    // Constructs an iterator pointing to the end of any range.
+    RbstSetRangeIterator() : m_stack(), m_remaining(0) { }
+
+    // Iterator comparisons (only valid for iterators over the same range!)
+    bool operator==(const RbstSetRangeIterator &other) const { return m_remaining == other.m_remaining; }
+    bool operator!=(const RbstSetRangeIterator &other) const { return m_remaining != other.m_remaining; }
+
+    // Accessing value (const only!)
+    const V &operator* () const  { return m_stack.back()->value(); }
+    const V *operator-> () const { return &m_stack.back()->value(); }
+
+    RbstSetRangeIterator &operator++ ()
+    {
+        const RbstValuedNode<V> *node = m_stack.back()->right();
+        m_stack.pop_back();
+        if (--m_remaining > 0) push_left(node);
+        return *this;
+    }
+
+    RbstSetRangeIterator operator++ (int)
+        { RbstSetRangeIterator old(*this); ++*this; return old; }
+
+protected:
+    // Pushes `node` and its left descendants on the stack.
+    void push_left(const RbstValuedNode<V> *node)
+        { for (; node; node = node->left()) m_stack.push_back(node); }
+
+private:
+    RbstPathStack<const RbstValuedNode<V>*> m_stack;
+    size_t m_remaining;
+
+    template<class W> friend class RbstSetRange;
+};
+
+/* A view of the elements of an RbstSet that lie in a half-open range [lo, hi)
+   (i.e. the elements between lower_bound(lo) and lower_bound(hi)).  These
+   bounds and the number of elements in the range are determined by a single
+   descent from the root, which is shared until the search paths for `lo` and
+   `hi` diverge.  The view is invalidated when the set is modified. */
+template<class V>
+class RbstSetRange
+{
+public:
+    typedef RbstSetRangeIterator<V> iterator, const_iterator;
+
+    // Constructs a view of all elements in the tree rooted at `root`.
+    RbstSetRange(const RbstValuedNode<V> *root, const RbstNode *end)
+        : m_begin(), m_upper(end)
+    {
+        m_begin.push_left(root);
+        m_begin.m_remaining = RbstNode::size(root);
+    }
+
+    // See RbstValuedNode for the requirements on the comparator.
+    template<class Comparator>
+    RbstSetRange( const RbstValuedNode<V> *root, const RbstNode *end,
+                  const V &lo, const V &hi, Comparator &comp );
+
+    // Size of the range:
+    bool empty() const  { return m_begin.m_remaining == 0; }
+    size_t size() const { return m_begin.m_remaining; }
+
+    // Forward iterators over the range:
+    const_iterator begin() const { return m_begin; }
+    const_iterator end() const   { return const_iterator(); }
+
+    // Returns the bounds of the range as random-access set iterators.
+    std::pair<RbstSetIterator<V>, RbstSetIterator<V> > bounds() const
+    {
+        return std::make_pair( RbstSetIterator<V>(empty() ? m_upper : m_begin.m_stack.back()),
+                               RbstSetIterator<V>(m_upper) );
+    }
+
+private:
+    iterator        m_begin;
+    const RbstNode  *m_upper;
+};
+
+template<class V> template<class Comparator>
+RbstSetRange<V>::RbstSetRange( const RbstValuedNode<V> *node,
+    const RbstNode *end, const V &lo, const V &hi, Comparator &comp )
+    : m_begin(), m_upper(end)
+{
+    // Descend to the first node in the range, if any:
+    while (node)
+    {
+        if (comp(node->value(), lo))
+            node = node->right();
+        else
+        if (!comp(node->value(), hi))
+            m_upper = node, node = node->left();
+        else
+            break;
+    }
+    if (!node) return;
+    size_t count = 1;
+
+    // Find elements greater than or equal to `lo` in the left subtree, and
+    // push them on the stack as we go:
+    m_begin.m_stack.push_back(node);
+    for (const RbstValuedNode<V> *left = node->left(); left; )
+    {
+        if (comp(left->value(), lo))
+        {
+            left = left->right();
+        }
+        else
+        {
+            count += 1 + RbstNode::size(left->right());
+            m_begin.m_stack.push_back(left);
+            left = left->left();
+        }
+    }
+
+    // Find elements less than `hi` in the right subtree:
+    for (const RbstValuedNode<V> *right = node->right(); right; )
+    {
+        if (comp(right->value(), hi))
+        {
+            count += 1 + RbstNode::size(right->left());
+            right = right->right();
+        }
+        else
+        {
+            m_upper = right;
+            right = right->left();
+        }
+    }
+    m_begin.m_remaining = count;
+}
+
 // The RbstSet class proper.  This is an ordered container that is intended
 // to be compatible with std::set, but has the added benefit that it provides
-// random-access iterators.
+// random-access iterators.  The node type may be a subclass of
+// RbstValuedNode<Key> that maintains extra data about its subtree through its
+// update_type hook, like RbstHashedNode.
 template< class Key,
           class Comparator,
           class Allocator,
-          class Rng >
+          class Rng,
+          class Node >
 class RbstSet
 {
 public:
@@ -127,7 +428,7 @@ public:
 
     // Iterators.
     typedef RbstSetIterator<Key> iterator, const_iterator;
-    typedef std::reverse_iterator<iterator> reverse_iterator, const_reverse_iterator;
+    typedef RbstSetReverseIterator<Key> reverse_iterator, const_reverse_iterator;
 
     // Destructor.
     ~RbstSet() { clear(); }
@@ -158,7 +459,7 @@ public:
     {
         // Note: this must be done after initializing the rng/node allocator,
         //       otherwise cloning doesn't work correctly!
-        m_tree.set_root(clone(that.m_tree.root()));
+        m_tree.set_root(clone(that.root()));
     }
 
     // Assignment operator.
@@ -168,7 +469,7 @@ public:
         {
             clear();
             m_tree.set_comp(that.m_tree.comp());
-            m_tree.set_root(clone(that.m_tree.root()));
+            m_tree.set_root(clone(that.root()));
         }
         return *this;
     }
@@ -177,7 +478,7 @@ public:
     const_iterator          begin() const   { return const_iterator(m_tree.first()); }
     const_iterator          end() const     { return const_iterator(static_cast<const RbstNode*>(&m_tree)); }
     const_reverse_iterator  rbegin() const  { return const_reverse_iterator(end()); }
-    const_reverse_iterator  rend() const    { return const_reverse_iterator(begin()); }
+    const_reverse_iterator  rend() const    { return const_reverse_iterator(static_cast<const RbstNode*>(&m_tree)); }
 
     // Size and capacity
     bool empty() const          { return m_tree.root() == NULL; }
@@ -187,7 +488,7 @@ public:
     // Erases all elements.
     void clear()
     {
-        free(const_cast<node_type*>(m_tree.root()));
+        free(const_cast<node_type*>(root()));
         m_tree.set_root(NULL);
     }
 
@@ -202,9 +503,9 @@ public:
         {
             return make_pair(iterator(node), false);
         }
-        node_type *new_node = m_node_alloc.allocate(1);
-        new (new_node) node_type(value);
-        m_tree.insert(*new_node, m_rng);
+        node_type *new_node = create(value);
+        update_type update;
+        m_tree.insert(*new_node, m_rng, update);
         return make_pair(iterator(new_node), true);
     }
 
@@ -216,29 +517,111 @@ public:
         return insert(val).second;
     }
 
+    /* Inserts the values in [first, last).  If the set is empty, the values
+       are sorted and built into a tree in O(N) time, like assign() does, but
+       serially, using the set's own RNG.  This requires that keys are
+       copy-assignable. */
     template <class InputIterator>
     void insert(InputIterator first, InputIterator last)
     {
+        if (empty())
+        {
+            std::vector<Key> values(first, last);
+            sort_unique(values, 1);
+            m_tree.set_root(build(values));
+            return;
+        }
         /* Note: should use position hint to make insertion of sorted ranges
                  more efficient (as is officially required). */
         while (first != last) insert(*first++);
     }
 
+    /* Inserts a value that is greater than all elements, such as the next key
+       of a time series.  The position is found by following the right spine
+       of the tree, without comparisons (see RbstNode::push_back()), after
+       checking the value against the last element.  If the value is not
+       greater, it is inserted regularly. */
+    std::pair<iterator,bool> push_back(const value_type &value)
+    {
+        const RbstNode *last = m_tree.left() ? m_tree.left()->last() : NULL;
+        if (last && !m_tree.comp()(static_cast<const node_type*>(last)->value(), value))
+            return insert(value);
+        node_type *new_node = create(value);
+        update_type update;
+        m_tree.push_back(*new_node, m_rng, update);
+        return make_pair(iterator(new_node), true);
+    }
+
+    /* Inserts the values in [first, last), which should be strictly
+       increasing and greater than all elements.  They are built into a tree
+       in O(K) time, as assign() does, which is joined with the existing tree
+       in O(log N) expected time.  If the values are not ordered like that,
+       they are inserted regularly. */
+    template <class InputIterator>
+    void append(InputIterator first, InputIterator last, unsigned threads = 0)
+    {
+        std::vector<Key> values(first, last);
+        if (values.empty()) return;
+        const Comparator &comp = m_tree.comp();
+        const RbstNode *back = m_tree.left() ? m_tree.left()->last() : NULL;
+        bool ordered = !back || comp(static_cast<const node_type*>(back)->value(), values[0]);
+        for (size_type i = 1; ordered && i < values.size(); ++i)
+            ordered = comp(values[i - 1], values[i]);
+        if (!ordered)
+        {
+            insert(values.begin(), values.end());
+            return;
+        }
+        if (threads == 0) threads = rbst_hardware_threads();
+        update_type update;
+        RbstNode *root = RbstNode::join(m_tree.left(), build(values, threads), m_rng, update);
+        m_tree.set_root(static_cast<node_type*>(root));
+    }
+
+    /* Replaces the contents of the set with the values in [first, last), which
+       need not be sorted.  The values are sorted (keeping the first of each
+       run of equivalent values, as insert() would) and the tree is built in
+       O(N) time, with the same shape distribution as one built by inserting
+       the values one by one.  Large inputs are sorted and built in parallel
+       by up to `threads` threads (by default: one per hardware thread), each
+       using its own RNG, seeded from the set's RNG.  This requires that keys
+       are copy-assignable, and that Rng can be constructed from a seed. */
+    template <class InputIterator>
+    void assign(InputIterator first, InputIterator last, unsigned threads = 0)
+    {
+        if (threads == 0) threads = rbst_hardware_threads();
+        std::vector<Key> values(first, last);
+        sort_unique(values, threads);
+        node_type *root = build(values, threads);
+        clear();
+        m_tree.set_root(root);
+    }
+
     // Erasing at a specific position:
     void erase(iterator pos)
     {
-        node_type *node = const_cast<node_type*>(static_cast<const node_type*>(pos.m_node));
-        node->erase(m_rng);
+        node_type *node = node_of(pos);
+        update_type update;
+        node->erase(m_rng, update);
         node->~node_type();
         m_node_alloc.deallocate(node, 1);
         pos.m_node = NULL;
     }
 
-    // Erasing a range of elements:
+    /* Erasing a range of elements.  The tree is split at both ends of the
+       range, and the outer parts are joined again, so this takes O(log N)
+       time plus the time to free the erased nodes. */
     void erase(iterator first, iterator last)
     {
-        // FIXME: we can erase ranges more efficiently!
-        while (first != last) erase(first++);
+        if (first == last) return;
+        size_type lo = first.index(), hi = last.index();
+        update_type update;
+        RbstNode *lesser, *middle, *greater;
+        RbstNode::split_at(m_tree.left(), hi, middle, greater, m_rng, update);
+        RbstNode::split_at(middle, lo, lesser, middle, m_rng, update);
+        free(static_cast<node_type*>(middle));
+        RbstNode *root = RbstNode::join(lesser, greater, m_rng, update);
+        m_tree.set_root(static_cast<node_type*>(root));
     }
 
     /* Erases elements which equal `key` and returns the number of elements
@@ -251,6 +634,53 @@ public:
         return 1;
     }
 
+    /* Replaces the element at `pos` with `value`.  If `value` is ordered
+       between the neighbours of `pos`, the node is overwritten in place, which
+       takes O(1) time plus the time to update the path to the root (which is
+       skipped for nodes without an update hook).  Otherwise, the node is
+       detached and reinserted with the new value, which reuses its allocation.
+       If another element is equivalent to `value`, the element at `pos` is
+       erased, and an iterator to the other element is returned with false,
+       as erase() followed by insert() would.  If assigning `value` to a
+       detached node throws, the element at `pos` is erased. */
+    std::pair<iterator,bool> replace(iterator pos, const value_type &value)
+    {
+        // The first node has no predecessor, and the last is followed by the
+        // tree sentinel (end()):
+        node_type *node = node_of(pos);
+        const RbstNode *prev = node->previous(), *next = node->next();
+        const Comparator &comp = m_tree.comp();
+        update_type update;
+        if ( (prev == NULL || comp(static_cast<const node_type*>(prev)->value(), value)) &&
+             (next == &m_tree || comp(value, static_cast<const node_type*>(next)->value())) )
+        {
+            node->set_value(value);
+            node->update_path(update);
+            return make_pair(pos, true);
+        }
+
+        node->erase(m_rng, update);
+        const RbstNode *other = m_tree.find(value);
+        if (other != &m_tree)
+        {
+            node->~node_type();
+            m_node_alloc.deallocate(node, 1);
+            return make_pair(iterator(other), false);
+        }
+        try
+        {
+            node->set_value(value);
+        }
+        catch (...)
+        {
+            node->~node_type();
+            m_node_alloc.deallocate(node, 1);
+            throw;
+        }
+        m_tree.insert(*node, m_rng, update);
+        return make_pair(pos, true);
+    }
+
     /* Efficiently swaps contents of two sets. */
     void swap(RbstSet &that)
     {
@@ -265,7 +695,7 @@ public:
     /* Returns how many elements in the set equal `key`. */
     size_type count(const Key &key) const
     {
-        return node_type::find(key, m_tree.root(), NULL) != NULL;
+        return m_tree.find(key) != &m_tree;
     }
 
     // Search for elements:
@@ -273,6 +703,17 @@ public:
     const_iterator lower_bound(const Key& key) const { return iterator(m_tree.lower_bound(key)); }
     const_iterator upper_bound(const Key& key) const { return iterator(m_tree.upper_bound(key)); }
 
+    // Get a view of all elements, or of those in the half-open range [lo, hi):
+    RbstSetRange<Key> range() const
+    {
+        return RbstSetRange<Key>(m_tree.root(), &m_tree);
+    }
+
+    RbstSetRange<Key> range(const Key &lo, const Key &hi) const
+    {
+        return RbstSetRange<Key>(m_tree.root(), &m_tree, lo, hi, m_tree.comp());
+    }
+
     // Get range of equal elements:
     std::pair<const_iterator,const_iterator> equal_range(const Key& key) const
     {
@@ -281,9 +722,128 @@ public:
         return std::make_pair(lo, hi);
     }
 
+    /* Writes iterators to the elements at a sorted (non-decreasing) range of
+       indices to `out`, with an index equal to size() yielding end().  This
+       is faster than looking up each element separately: see
+       RbstNode::at_many(). */
+    template<class IndexIterator, class OutputIterator>
+    OutputIterator at_many( IndexIterator first, IndexIterator last,
+                            OutputIterator out ) const
+    {
+        return m_tree.at_many(first, last, out);
+    }
+
+    /* Writes the rank of each key in a sorted range to `out`: the number of
+       elements less than the key, i.e. the index of lower_bound(key).  Like
+       at_many(), this traverses the search paths of all keys at once. */
+    template<class KeyIterator, class OutputIterator>
+    OutputIterator rank_many( KeyIterator first, KeyIterator last,
+                              OutputIterator out ) const
+    {
+        return m_tree.rank_many(first, last, out);
+    }
+
+    /* Returns q + 1 iterators which divide the set into q parts of (nearly)
+       equal size: the i-th iterator refers to the element at index i*N/q, so
+       the first is begin() and the last is end().  Requires q >= 1. */
+    std::vector<const_iterator> quantiles(size_type q) const
+    {
+        assert(q > 0);
+        std::vector<size_type> indices;
+        for (size_type i = 0; i <= q; ++i) indices.push_back(i*size()/q);
+        std::vector<const_iterator> res;
+        at_many(indices.begin(), indices.end(), std::back_inserter(res));
+        return res;
+    }
+
+    /* Copies the elements of the set in order to the range starting at `out`,
+       and returns the end of the output range.  Since the output position of
+       each subtree follows from the subtree sizes, large sets are copied in
+       parallel by up to `threads` threads (by default: one per hardware
+       thread).  If copying an element throws, the exception is passed on
+       and the output range is left partially written. */
+    template<class RandomAccessIterator>
+    RandomAccessIterator copy_to( RandomAccessIterator out,
+                                  unsigned threads = 0 ) const
+    {
+        if (threads == 0) threads = rbst_hardware_threads();
+        size_type n = size(), grain = std::max<size_type>(n/(8*threads), 1 << 16);
+        if (threads == 1 || n <= grain)
+            return node_type::copy(root(), out);
+        CopyTasks<RandomAccessIterator> tasks(out);
+        tasks.split(root(), 0, grain);
+        rbst_parallel_for(tasks.subtrees.size(), threads, tasks);
+        return out + n;
+    }
+
+    // Returns a vector containing the elements of the set in order.  This
+    // requires that keys are default-constructible.  See copy_to().
+    std::vector<Key> to_vector(unsigned threads = 0) const
+    {
+        std::vector<Key> res(size());
+        copy_to(res.begin(), threads);
+        return res;
+    }
+
+    /* Returns the number of elements in both this set and `other`, without
+       constructing the intersection.  The smaller set is traversed, skipping
+       subtrees whose key range contains no elements of the larger set; see
+       RbstValuedNode::count_common().  Both sets must be ordered alike. */
+    size_type intersection_size(const RbstSet &other) const
+    {
+        if (&other == this) return size();
+        const RbstSet &a = size() <= other.size() ? *this : other,
+                      &b = size() <= other.size() ? other : *this;
+        return node_type::count_common(a.root(), b.root(), m_tree.comp());
+    }
+
+    // Returns the number of elements in either this set or `other`.
+    size_type union_size(const RbstSet &other) const
+    {
+        return size() + other.size() - intersection_size(other);
+    }
+
+    /* The following require a node type with subtree hashes, such as
+       RbstHashedNode (see RbstHash.h).  hash() returns the hash of all
+       elements, which depends only on the elements and not on the shape of
+       the tree.  diff() writes the elements of this set that are not in
+       `other` to `only_this`, and those of `other` that are not in this set
+       to `only_other`, both in order, and returns the ends of both output
+       ranges.  Subtrees whose key range has the same hash in both sets are
+       skipped; see RbstHashedNode::diff(). */
+    uint64_t hash() const { return node_type::hash(root()); }
+
+    template<class OutputIterator1, class OutputIterator2>
+    std::pair<OutputIterator1, OutputIterator2> diff( const RbstSet &other,
+        OutputIterator1 only_this, OutputIterator2 only_other ) const
+    {
+        node_type::diff(root(), other.root(), m_tree.comp(), only_this, only_other);
+        return std::make_pair(only_this, only_other);
+    }
+
+    /* Returns whether the element at `a` comes before the element at `b`,
+       where end() comes after all elements.  Iterator comparisons like
+       `a < b` compute the indices of both positions, which climbs to the
+       root twice; since the keys of a set are ordered, comparing them gives
+       the same answer with one key comparison. */
+    bool precedes(const_iterator a, const_iterator b) const
+    {
+        if (b == end()) return a != end();
+        return a != end() && m_tree.comp()(*a, *b);
+    }
+
+    // Orders iterators of a set by position, using precedes().
+    struct iterator_compare
+    {
+        iterator_compare(const RbstSet &set) : set(&set) { }
+        bool operator()(const_iterator a, const_iterator b) const { return set->precedes(a, b); }
+        const RbstSet *set;
+    };
+
     // Access to comparators used:
-    key_compare   key_comp() const   { return m_tree.comp(); }
-    value_compare value_comp() const { return m_tree.comp(); }
+    key_compare      key_comp() const      { return m_tree.comp(); }
+    value_compare    value_comp() const    { return m_tree.comp(); }
+    iterator_compare iterator_comp() const { return iterator_compare(*this); }
 
     // Access to RNG used:
     Rng rng() const { return m_rng; }
@@ -292,9 +852,34 @@ public:
     const RbstTree<Key, Comparator> &debug_tree() { return m_tree; }
 
 protected:
-    typedef RbstValuedNode<Key> node_type;
+    typedef Node node_type;
+    typedef typename node_type::update_type update_type;
+
+    const node_type *root() const { return static_cast<const node_type*>(m_tree.root()); }
+
+    // Returns the node referred to by an iterator (which must not be end()).
+    static node_type *node_of(const_iterator it)
+    {
+        return const_cast<node_type*>(static_cast<const node_type*>(it.m_node));
+    }
     typedef typename Allocator::template rebind<node_type>::other node_allocator_type;
 
+    // Allocates and constructs a node; the memory is freed if construction throws.
+    node_type *create(const value_type &value)
+    {
+        node_type *node = m_node_alloc.allocate(1);
+        try
+        {
+            new (node) node_type(value);
+        }
+        catch (...)
+        {
+            m_node_alloc.deallocate(node, 1);
+            throw;
+        }
+        return node;
+    }
+
     /* Returns a deep copy of a the subtree rooted at `node`, and sets the
        parent of the new root node (if not NULL) to `parent`. */
     node_type *clone(const node_type *node, node_type *parent = NULL)
@@ -306,6 +891,182 @@ protected:
         return copy;
     }
 
+    // Equivalence predicate for sorted values (used by assign()).
+    struct Equivalent
+    {
+        Equivalent(const Comparator &comp) : comp(comp) { }
+        bool operator()(const Key &a, const Key &b) const { return !comp(a, b); }
+        Comparator comp;
+    };
+
+    // Sorts `values` stably, and keeps only the first of each run of
+    // equivalent values (as insert() would).
+    void sort_unique(std::vector<Key> &values, unsigned threads)
+    {
+        if (!values.empty())
+            rbst_sort(&values[0], &values[0] + values.size(), m_tree.comp(), threads);
+        values.erase( std::unique(values.begin(), values.end(),
+                                  Equivalent(m_tree.comp())), values.end() );
+    }
+
+    /* Builds a random binary search tree from sorted `values` in O(N) time:
+       the root is chosen uniformly at random, and the subtrees are built
+       recursively.  Nodes are allocated beforehand, so that only construction
+       happens in parallel (the node allocator need not be thread-safe).
+       Subtrees built in parallel use RNGs constructed from a seed. */
+    node_type *build(const std::vector<Key> &values, unsigned threads)
+    {
+        BuildTasks tasks(values, m_node_alloc);
+        size_type n = values.size(),
+                  grain = std::max<size_type>(n/(8*threads), 1 << 16);
+        node_type *root = tasks.split(0, n, NULL, grain, m_rng);
+        rbst_parallel_for(tasks.subtrees.size(), threads, tasks);
+        tasks.finish();
+        return root;
+    }
+
+    // Builds a tree from sorted `values` like above, serially with m_rng.
+    node_type *build(const std::vector<Key> &values)
+    {
+        if (values.empty()) return NULL;
+        BuildTasks tasks(values, m_node_alloc);
+        size_type n = values.size();
+        node_type *root = tasks.build(0, m_rng(n), n, NULL, m_rng);
+        tasks.finish();
+        return root;
+    }
+
+    // Task list for build().  Chooses the nodes near the root directly, and
+    // collects subtrees of at most `grain` nodes to be built in parallel.
+    // The nodes near the root are constructed last, by finish(), since their
+    // sizes depend on their children.
+    // If building fails, the destructor frees all nodes.
+    struct BuildTasks
+    {
+        BuildTasks(const std::vector<Key> &values, node_allocator_type &alloc)
+            : values(values), alloc(alloc), nodes(values.size(), NULL),
+              built(values.size(), 0), done(false)
+        {
+            try
+            {
+                for (size_type i = 0; i < nodes.size(); ++i)
+                    nodes[i] = alloc.allocate(1);
+            }
+            catch (...)
+            {
+                release();
+                throw;
+            }
+        }
+
+        ~BuildTasks() { if (!done) release(); }
+
+        // Destroys the nodes that were constructed, and deallocates all nodes.
+        void release()
+        {
+            for (size_type i = 0; i < nodes.size() && nodes[i]; ++i)
+            {
+                if (built[i]) nodes[i]->~node_type();
+                alloc.deallocate(nodes[i], 1);
+            }
+        }
+
+        // Splits [lo, hi) into subtree tasks, and returns the subtree root.
+        node_type *split( size_type lo, size_type hi, node_type *parent,
+                          size_type grain, Rng &rng )
+        {
+            if (lo == hi) return NULL;
+            Subtree s = { lo, lo + rng(hi - lo), hi, parent, NULL, NULL, 0 };
+            if (hi - lo <= grain)
+            {
+                s.seed = rng(0x7fffffff);
+                subtrees.push_back(s);
+            }
+            else
+            {
+                s.left  = split(lo, s.mid, nodes[s.mid], grain, rng);
+                s.right = split(s.mid + 1, hi, nodes[s.mid], grain, rng);
+                tops.push_back(s);
+            }
+            return nodes[s.mid];
+        }
+
+        // Builds the subtree on [lo, hi) with root `mid`, and returns it.
+        node_type *build( size_type lo, size_type mid, size_type hi,
+                          node_type *parent, Rng &rng )
+        {
+            node_type *left  = NULL, *right = NULL;
+            if (lo < mid) left  = build(lo, lo + rng(mid - lo), mid, nodes[mid], rng);
+            if (mid + 1 < hi) right = build(mid + 1, mid + 1 + rng(hi - mid - 1), hi, nodes[mid], rng);
+            new (nodes[mid]) node_type(values[mid], left, right, parent);
+            built[mid] = 1;
+            return nodes[mid];
+        }
+
+        void operator()(size_t i)
+        {
+            const Subtree &s = subtrees[i];
+            Rng rng(s.seed);
+            build(s.lo, s.mid, s.hi, s.parent, rng);
+        }
+
+        // Constructs the nodes near the root, bottom-up.
+        void finish()
+        {
+            for (size_type i = 0; i < tops.size(); ++i)
+            {
+                const Subtree &s = tops[i];
+                new (nodes[s.mid]) node_type(values[s.mid], s.left, s.right, s.parent);
+                built[s.mid] = 1;
+            }
+            done = true;
+        }
+
+        struct Subtree
+        {
+            size_type lo, mid, hi;
+            node_type *parent, *left, *right;
+            size_type seed;     // only for parallel tasks
+        };
+
+        const std::vector<Key>      &values;
+        node_allocator_type         &alloc;
+        std::vector<node_type*>     nodes;
+        std::vector<char>           built;      // whether each node is constructed
+        std::vector<Subtree>        subtrees, tops;
+        bool                        done;
+    };
+
+    // Task list for copy_to().  Copies nodes near the root directly, and
+    // collects subtrees with at most `grain` nodes to be copied in parallel.
+    template<class RandomAccessIterator>
+    struct CopyTasks
+    {
+        CopyTasks(RandomAccessIterator out) : out(out) { }
+
+        void split(const node_type *node, size_type pos, size_type grain)
+        {
+            if (!node) return;
+            if (node->size() <= grain)
+            {
+                subtrees.push_back(std::make_pair(node, pos));
+                return;
+            }
+            size_type left = RbstNode::size(node->left());
+            split(node->left(), pos, grain);
+            out[pos + left] = node->value();
+            split(node->right(), pos + left + 1, grain);
+        }
+
+        void operator()(size_t i)
+        {
+            node_type::copy(subtrees[i].first, out + subtrees[i].second);
+        }
+
+        RandomAccessIterator out;
+        std::vector<std::pair<const node_type*, size_type> > subtrees;
+    };
+
     // Frees all nodes in the subtree rooted at `node`.
     void free(node_type *node)
     {
@@ -325,57 +1086,139 @@ protected:
 
 // Comparison operators
 
-template<class Key, class Comparator, class Allocator>
-bool operator== ( const RbstSet<Key,Comparator,Allocator> &lhs,
-                  const RbstSet<Key,Comparator,Allocator> &rhs )
+/* Helper class for the comparison operators below, which compares the first
+   `n` elements of two ranges.  This version compares elements one at a time;
+   the specialization below handles integer keys. */
+template<class V, bool Integer = std::numeric_limits<V>::is_integer>
+struct RbstSetComparison
+{
+    typedef RbstSetRangeIterator<V> iterator;
+
+    static bool equal(iterator a, iterator b)
+    {
+        return std::equal(a, iterator(), b);
+    }
+
+    static bool less(iterator a, iterator b)
+    {
+        return std::lexicographical_compare(a, iterator(), b, iterator());
+    }
+};
+
+/* For integer keys, elements are copied into blocks which are compared with
+   memcmp(), which is vectorized, instead of element by element.  (This isn't
+   valid for floating point keys, due to signed zeroes and NaNs.) */
+template<class V>
+struct RbstSetComparison<V, true>
+{
+    typedef RbstSetRangeIterator<V> iterator;
+
+    static const size_t block_size = 64;
+
+    static bool equal(iterator a, iterator b)
+    {
+        V block_a[block_size], block_b[block_size];
+        for (iterator end; a != end; )
+        {
+            size_t n = fill(a, block_a);
+            fill(b, block_b);
+            if (memcmp(block_a, block_b, n*sizeof(V)) != 0) return false;
+        }
+        return true;
+    }
+
+    static bool less(iterator a, iterator b)
+    {
+        V block_a[block_size], block_b[block_size];
+        for (iterator end; a != end && b != end; )
+        {
+            size_t n = fill(a, block_a), m = fill(b, block_b);
+            if (memcmp(block_a, block_b, std::min(n, m)*sizeof(V)) != 0)
+            {
+                std::pair<V*, V*> p = std::mismatch(block_a, block_a + n, block_b);
+                return *p.first < *p.second;
+            }
+            if (n != m) return n < m;
+        }
+        return b != iterator();
+    }
+
+private:
+    // Copies up to block_size elements into `block` and returns the count.
+    static size_t fill(iterator &it, V *block)
+    {
+        size_t n = 0;
+        for (iterator end; n < block_size && it != end; ++it) block[n++] = *it;
+        return n;
+    }
+};
+
+template<class Key, class Comparator, class Allocator, class Rng, class Node>
+bool operator== ( const RbstSet<Key,Comparator,Allocator,Rng,Node> &lhs,
+                  const RbstSet<Key,Comparator,Allocator,Rng,Node> &rhs )
 {
     return (&lhs == &rhs) || (lhs.size() == rhs.size() &&
-        std::equal(lhs.begin(), lhs.end(), rhs.begin()));
+        RbstSetComparison<Key>::equal(lhs.range().begin(), rhs.range().begin()));
 }
 
-template<class Key, class Comparator, class Allocator>
-bool operator!= ( const RbstSet<Key,Comparator,Allocator> &lhs,
-                  const RbstSet<Key,Comparator,Allocator> &rhs )
+template<class Key, class Comparator, class Allocator, class Rng, class Node>
+bool operator!= ( const RbstSet<Key,Comparator,Allocator,Rng,Node> &lhs,
+                  const RbstSet<Key,Comparator,Allocator,Rng,Node> &rhs )
 {
     return !(lhs == rhs);
 }
 
-template<class Key, class Comparator, class Allocator>
-bool operator< ( const RbstSet<Key,Comparator,Allocator> &lhs,
-                 const RbstSet<Key,Comparator,Allocator> &rhs )
+template<class Key, class Comparator, class Allocator, class Rng, class Node>
+bool operator< ( const RbstSet<Key,Comparator,Allocator,Rng,Node> &lhs,
+                 const RbstSet<Key,Comparator,Allocator,Rng,Node> &rhs )
 {
-    return (&lhs != &rhs) && std::lexicographical_compare(
-        lhs.begin(), lhs.end(), rhs.begin(), rhs.end());
+    return (&lhs != &rhs) &&
+        RbstSetComparison<Key>::less(lhs.range().begin(), rhs.range().begin());
 }
 
-template<class Key, class Comparator, class Allocator>
-bool operator> ( const RbstSet<Key,Comparator,Allocator> &lhs,
-                 const RbstSet<Key,Comparator,Allocator> &rhs )
+template<class Key, class Comparator, class Allocator, class Rng, class Node>
+bool operator> ( const RbstSet<Key,Comparator,Allocator,Rng,Node> &lhs,
+                 const RbstSet<Key,Comparator,Allocator,Rng,Node> &rhs )
 {
     return rhs < lhs;
 }
 
-template<class Key, class Comparator, class Allocator>
-bool operator<= ( const RbstSet<Key,Comparator,Allocator> &lhs,
-                  const RbstSet<Key,Comparator,Allocator> &rhs )
+template<class Key, class Comparator, class Allocator, class Rng, class Node>
+bool operator<= ( const RbstSet<Key,Comparator,Allocator,Rng,Node> &lhs,
+                  const RbstSet<Key,Comparator,Allocator,Rng,Node> &rhs )
 {
     return !(lhs > rhs);
 }
 
-template<class Key, class Comparator, class Allocator>
-bool operator>= ( const RbstSet<Key,Comparator,Allocator> &lhs,
-                  const RbstSet<Key,Comparator,Allocator> &rhs )
+template<class Key, class Comparator, class Allocator, class Rng, class Node>
+bool operator>= ( const RbstSet<Key,Comparator,Allocator,Rng,Node> &lhs,
+                  const RbstSet<Key,Comparator,Allocator,Rng,Node> &rhs )
 {
     return rhs <= lhs;
 }
 
+// Set cardinalities (see RbstSet::intersection_size() and union_size()):
+template<class Key, class Comparator, class Allocator, class Rng, class Node>
+size_t intersection_size( const RbstSet<Key,Comparator,Allocator,Rng,Node> &a,
+                          const RbstSet<Key,Comparator,Allocator,Rng,Node> &b )
+{
+    return a.intersection_size(b);
+}
+
+template<class Key, class Comparator, class Allocator, class Rng, class Node>
+size_t union_size( const RbstSet<Key,Comparator,Allocator,Rng,Node> &a,
+                   const RbstSet<Key,Comparator,Allocator,Rng,Node> &b )
+{
+    return a.union_size(b);
+}
+
 // std::swap() implementation:
 
 namespace std
 {
-    template<class Key, class Comparator, class Allocator>
-    inline void swap( RbstSet<Key,Comparator,Allocator> &lhs,
-                      RbstSet<Key,Comparator,Allocator> &rhs )
+    template<class Key, class Comparator, class Allocator, class Rng, class Node>
+    inline void swap( RbstSet<Key,Comparator,Allocator,Rng,Node> &lhs,
+                      RbstSet<Key,Comparator,Allocator,Rng,Node> &rhs )
     {
         lhs.swap(rhs);
     }
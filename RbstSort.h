@@ -0,0 +1,181 @@
+#ifndef RBST_SORT_H_INCLUDED
+#define RBST_SORT_H_INCLUDED
+
+#include "RbstParallel.h"
+#include <stdint.h>
+#include <string.h>
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <vector>
+
+// Sorting of keys for the bulk operations of RbstSet.  Keys of integer and
+// floating point types which are ordered by std::less are sorted with an LSD
+// radix sort; all other keys with a comparison-based stable sort.
+
+// Unsigned integer type of a given size in bytes (if any).
+template<size_t Size> struct RbstUnsigned { };
+template<> struct RbstUnsigned<1> { typedef uint8_t  type; };
+template<> struct RbstUnsigned<2> { typedef uint16_t type; };
+template<> struct RbstUnsigned<4> { typedef uint32_t type; };
+template<> struct RbstUnsigned<8> { typedef uint64_t type; };
+
+/* Maps keys of type T to unsigned integers of the same size, such that the
+   order of the integers matches the order of the keys.  Types which cannot be
+   mapped this way (including integers without an RbstUnsigned of their size,
+   such as __int128) get radix == false. */
+template< class T,
+          bool Integer = std::numeric_limits<T>::is_integer &&
+                         (sizeof(T) == 1 || sizeof(T) == 2 ||
+                          sizeof(T) == 4 || sizeof(T) == 8),
+          bool Float = std::numeric_limits<T>::is_iec559 &&
+                       (sizeof(T) == 4 || sizeof(T) == 8) >
+struct RbstRadixTraits
+{
+    static const bool radix = false;
+};
+
+// Integers: flip the sign bit of signed integers.
+template<class T>
+struct RbstRadixTraits<T, true, false>
+{
+    static const bool radix = true;
+    typedef typename RbstUnsigned<sizeof(T)>::type key_type;
+
+    static key_type key(T value)
+    {
+        key_type bits = (key_type)value;
+        if (std::numeric_limits<T>::is_signed)
+            bits ^= (key_type)1 << (8*sizeof(T) - 1);
+        return bits;
+    }
+};
+
+// Floating point numbers: flip all bits of negative numbers, and the sign bit
+// of positive numbers.  Negative zero is mapped like positive zero, since the
+// two compare equal (and equal keys must keep their relative order.)
+template<class T>
+struct RbstRadixTraits<T, false, true>
+{
+    static const bool radix = true;
+    typedef typename RbstUnsigned<sizeof(T)>::type key_type;
+
+    static key_type key(T value)
+    {
+        if (value == 0) value = 0;
+        key_type bits;
+        memcpy(&bits, &value, sizeof(bits));
+        const key_type sign = (key_type)1 << (8*sizeof(T) - 1);
+        return (bits & sign) ? ~bits : (bits | sign);
+    }
+};
+
+// Task for rbst_radix_sort(), which processes one chunk of the input.
+template<class T>
+struct RbstRadixTask
+{
+    typedef RbstRadixTraits<T> traits;
+
+    RbstRadixTask(size_t chunks) : counts(chunks*256), shift(0), counting(true) { }
+
+    void operator()(size_t c)
+    {
+        size_t *count = &counts[256*c];
+        if (counting)
+        {
+            for (const T *p = bounds[c]; p != bounds[c + 1]; ++p)
+                ++count[(traits::key(*p) >> shift) & 255];
+        }
+        else
+        {
+            for (const T *p = bounds[c]; p != bounds[c + 1]; ++p)
+                output[count[(traits::key(*p) >> shift) & 255]++] = *p;
+        }
+    }
+
+    std::vector<const T*> bounds;
+    std::vector<size_t> counts;
+    T *output;
+    unsigned shift;
+    bool counting;
+};
+
+/* Sorts [first, last) with a stable LSD radix sort on 8-bit digits, using up
+   to `threads` threads.  Each pass counts digits per chunk of the input (in
+   parallel), computes where each chunk's elements go, and moves them to a
+   buffer (in parallel).  Passes in which all elements have the same digit are
+   skipped, so small key ranges are sorted in fewer passes. */
+template<class T>
+void rbst_radix_sort(T *first, T *last, unsigned threads)
+{
+    typedef RbstRadixTraits<T> traits;
+    const size_t min_chunk = 1 << 16;
+    size_t n = last - first, chunks = std::max<size_t>(1, std::min<size_t>(threads, n/min_chunk));
+    if (n < 2) return;
+
+    // Determine which digits differ between elements:
+    typename traits::key_type lo = traits::key(*first), diff = 0;
+    for (const T *p = first; p != last; ++p) diff |= traits::key(*p) ^ lo;
+
+    std::vector<T> buffer(first, last);
+    T *input = first, *output = &buffer[0];
+    RbstRadixTask<T> task(chunks);
+    for (unsigned shift = 0; shift < 8*sizeof(T); shift += 8)
+    {
+        if (((diff >> shift) & 255) == 0) continue;
+
+        task.bounds.clear();
+        for (size_t c = 0; c <= chunks; ++c) task.bounds.push_back(input + n*c/chunks);
+        std::fill(task.counts.begin(), task.counts.end(), 0);
+        task.shift    = shift;
+        task.counting = true;
+        rbst_parallel_for(chunks, threads, task);
+
+        // Convert counts to output positions, ordered by digit, then chunk:
+        size_t pos = 0;
+        for (size_t d = 0; d < 256; ++d)
+        {
+            for (size_t c = 0; c < chunks; ++c)
+            {
+                size_t count = task.counts[256*c + d];
+                task.counts[256*c + d] = pos;
+                pos += count;
+            }
+        }
+        task.output   = output;
+        task.counting = false;
+        rbst_parallel_for(chunks, threads, task);
+        std::swap(input, output);
+    }
+    if (input != first) std::copy(input, input + n, first);
+}
+
+// Sorts with rbst_parallel_stable_sort(), or rbst_radix_sort() if possible.
+template<class T, class Compare, bool Radix = false>
+struct RbstSorter
+{
+    static void sort(T *first, T *last, const Compare &comp, unsigned threads)
+    {
+        rbst_parallel_stable_sort(first, last, comp, threads);
+    }
+};
+
+template<class T>
+struct RbstSorter<T, std::less<T>, true>
+{
+    static void sort(T *first, T *last, const std::less<T> &, unsigned threads)
+    {
+        rbst_radix_sort(first, last, threads);
+    }
+};
+
+/* Sorts [first, last) stably using up to `threads` threads.  The algorithm is
+   selected at compile time: radix sort for integer and floating point keys
+   ordered by std::less, and a parallel merge sort otherwise. */
+template<class T, class Compare>
+void rbst_sort(T *first, T *last, const Compare &comp, unsigned threads)
+{
+    RbstSorter<T, Compare, RbstRadixTraits<T>::radix>::sort(first, last, comp, threads);
+}
+
+#endif  /* ndef RBST_SORT_H_INCLUDED */
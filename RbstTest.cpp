@@ -1,12 +1,25 @@
 #include <assert.h>
+#include <ctype.h>
+#include <math.h>
+#include <algorithm>
 #include <set>
 #include <vector>
 #include <string>
 #include <utility>
 
 #include "RbstNode.h"
+#include "RbstAdaptive.h"
+#include "RbstBoundedSet.h"
 #include "RbstCheck.h"
+#include "RbstCountedMultiset.h"
+#include "RbstFilter.h"
+#include "RbstHash.h"
+#include "RbstHashIndex.h"
+#include "RbstRangeCount.h"
+#include "RbstRangeSet.h"
+#include "RbstRope.h"
 #include "RbstSet.h"
+#include "RbstVersioned.h"
 
 
 // Debug-dump tree structure and values:
@@ -29,8 +42,8 @@ static std::vector<int> get_contents(It begin, It end)
     return res;
 }
 
-template<class Compare>
-static void check(RbstSet<int, Compare> &set)
+template<class Compare, class Allocator, class Rng, class Node>
+static void check(RbstSet<int, Compare, Allocator, Rng, Node> &set)
 {
     assert(set.empty() == (set.size() == 0));
     const RbstTree<int, Compare> &tree = set.debug_tree();
@@ -523,6 +536,1357 @@ static void test9()
     assert(allocated.empty());
 }
 
+// Test deterministic weight-balanced trees.
+static void test10()
+{
+    typedef RbstSet<int, std::less<int>, std::allocator<int>, RbstWeightBalanced> set_t;
+    typedef std::set<int> ref_t;
+
+    // Sequential insertion and erasure (worst case for naive trees):
+    set_t test;
+    for (int i = 0; i < 1000; ++i)
+    {
+        test.insert(i);
+        assert(rbst_check_weight_balance(test.debug_tree().root()));
+    }
+    check(test);
+    assert(rbst_max_depth(test.debug_tree().root()) <= 15);
+    for (int i = 0; i < 1000; i += 2) test.erase(i);
+    assert(rbst_check_weight_balance(test.debug_tree().root()));
+    check(test);
+    for (int i = 0; i < 500; ++i) assert(test.begin()[i] == 2*i + 1);
+
+    // Random operations:
+    ref_t reference(test.begin(), test.end());
+    for (int n = 0; n < 100000; ++n)
+    {
+        int i = rand()%2000;
+        if (rand()%2)
+        {
+            assert(test.insert(i).second == reference.insert(i).second);
+        }
+        else
+        {
+            assert(test.erase(i) == reference.erase(i));
+        }
+        if (n%1000 == 0)
+        {
+            check(test);
+            assert(rbst_check_weight_balance(test.debug_tree().root()));
+        }
+    }
+    check(test);
+    assert(rbst_check_weight_balance(test.debug_tree().root()));
+    assert(test.size() == reference.size());
+    assert(std::equal(reference.begin(), reference.end(), test.begin()));
+}
+
+// Tests random-access reverse iterators.
+static void test11()
+{
+    typedef RbstSet<int>::const_reverse_iterator rit_t;
+
+    RbstSet<int> test;
+    assert(test.rbegin() == test.rend());
+    assert(test.rend() - test.rbegin() == 0);
+    assert(test.rbegin().base() == test.end());
+    assert(test.rend().base() == test.begin());
+
+    for (int i = 0; i < 20; ++i)
+        test.insert(7*i%20);
+
+    // Reverse end is reachable from both directions:
+    assert(++rit_t(test.find(0) + 1) == test.rend());
+    assert(--test.rend() == rit_t(test.find(0) + 1));
+    assert(*--test.rend() == 0);
+    assert(test.rbegin() + 20 == test.rend());
+    assert(test.rend() - 20 == test.rbegin());
+
+    rit_t it = test.rbegin();
+    for (int i = 0; i <= 20; ++i)
+    {
+        assert(it - test.rbegin() == i);
+        assert(test.rend() - it == 20 - i);
+        assert(it.base() == test.end() - i);
+        assert(rit_t(it.base()) == it);
+        rit_t jt = test.rbegin();
+        for (int j = 0; j < 20; ++j)
+        {
+            assert(*(it + (j - i)) == 19 - j);
+            assert(*((j - i) + it) == 19 - j);
+            assert(*(it - (i - j)) == 19 - j);
+            assert(it[j - i] == 19 - j);
+            assert(it + (j - i) == jt);
+            assert(it - jt == i - j);
+            assert((it <  jt) == (i <  j));
+            assert((it <= jt) == (i <= j));
+            assert((it >  jt) == (i >  j));
+            assert((it >= jt) == (i >= j));
+            ++jt;
+        }
+        assert(it + (20 - i) == test.rend());
+        if (it != test.rend())
+        {
+            rit_t old = it++;
+            assert(old != it && old + 1 == it);
+            assert(--it == old);
+            it += 1;
+        }
+    }
+
+    // Reverse iteration visits the same elements as forward iteration:
+    std::vector<int> a = get_contents(test.begin(), test.end());
+    std::vector<int> b = get_contents(test.rbegin(), test.rend());
+    std::reverse(b.begin(), b.end());
+    assert(a == b);
+}
+
+// An RNG which always returns 0, so that every insertion is at the root.
+struct ZeroRng
+{
+    size_t operator()(size_t) { return 0; }
+};
+
+// Tests range views.
+static void test12()
+{
+    typedef RbstSet<int>  set_t;
+    typedef std::set<int> ref_t;
+
+    set_t test;
+    ref_t reference;
+    for (int n = 0; n < 300; ++n)
+    {
+        int i = rand()%500;
+        test.insert(i);
+        reference.insert(i);
+    }
+
+    assert(set_t().range(1, 2).empty());
+    assert(set_t().range(1, 2).begin() == set_t().range(1, 2).end());
+
+    for (int n = 0; n < 2000; ++n)
+    {
+        int lo = rand()%520 - 10, hi = lo + rand()%100;
+        RbstSetRange<int> range = test.range(lo, hi);
+        std::vector<int> a = get_contents(range.begin(), range.end());
+        std::vector<int> b = get_contents( reference.lower_bound(lo),
+                                           reference.lower_bound(hi) );
+        assert(a == b);
+        assert(range.size() == b.size());
+        assert(range.empty() == b.empty());
+        assert(range.bounds().first  == test.lower_bound(lo));
+        assert(range.bounds().second == test.lower_bound(hi));
+        assert((size_t)(range.bounds().second - range.bounds().first) == b.size());
+    }
+
+    // Inserting increasing keys at the root gives a left chain, so iterators
+    // keep deep stacks, which must survive copying:
+    RbstSet<int, std::less<int>, std::allocator<int>, ZeroRng> chain;
+    for (int i = 0; i < 200; ++i) chain.insert(i);
+    RbstSetRange<int> all = chain.range();
+    RbstSetRange<int>::iterator it = all.begin(), copy;
+    for (int i = 0; i < 100; ++i) ++it;
+    copy = it;
+    RbstSetRange<int>::iterator copy2(copy);
+    assert(get_contents(it, all.end()) == get_contents(chain.begin() + 100, chain.end()));
+    assert(get_contents(copy2, all.end()) == get_contents(chain.begin() + 100, chain.end()));
+    assert(get_contents(all.begin(), all.end()) == get_contents(chain.begin(), chain.end()));
+}
+
+// Checks set comparison operators against std::set on larger sets, with
+// integer keys (compared blockwise) and other keys (compared elementwise).
+template<class Key>
+static void test13_compare(const std::set<Key> &a, const std::set<Key> &b)
+{
+    RbstSet<Key> c(a.begin(), a.end()), d(b.begin(), b.end());
+    assert((c == d) == (a == b));
+    assert((c != d) == (a != b));
+    assert((c <  d) == (a <  b));
+    assert((c <= d) == (a <= b));
+    assert((c >  d) == (a >  b));
+    assert((c >= d) == (a >= b));
+}
+
+static void test13()
+{
+    for (int n = 0; n < 500; ++n)
+    {
+        std::set<int> a, b;
+        std::set<std::pair<int,int> > c, d;
+        int size = rand()%300, range = 1 + rand()%1000;
+        for (int i = 0; i < size; ++i)
+        {
+            int x = rand()%range;
+            a.insert(x);
+            c.insert(std::make_pair(x, 0));
+        }
+        b = a;
+        d = c;
+        switch (rand()%4)
+        {
+        case 0: break;
+        case 1: if (!b.empty()) b.erase(--b.end()), d.erase(--d.end()); break;
+        case 2: b.insert(rand()%range), d.insert(std::make_pair(rand()%range, 0)); break;
+        case 3: if (!b.empty()) b.erase(b.begin()), d.erase(d.begin()); break;
+        }
+        test13_compare(a, b);
+        test13_compare(b, a);
+        test13_compare(c, d);
+        test13_compare(d, c);
+    }
+}
+
+// A task for rbst_parallel_for() which throws its index for one index.
+struct ThrowingTask
+{
+    ThrowingTask(size_t bad) : bad(bad) { }
+    void operator()(size_t i) { if (i == bad) throw (int)i; }
+    size_t bad;
+};
+
+// Tests exporting sets to arrays, serially and in parallel.
+static void test14()
+{
+    RbstSet<int> test;
+    assert(test.to_vector().empty());
+    for (int i = 0; i < 150000; ++i) test.insert(rand()%1000000);
+
+    std::vector<int> expected = get_contents(test.begin(), test.end());
+    assert(test.to_vector(1) == expected);
+    assert(test.to_vector(8) == expected);
+    assert(test.to_vector() == expected);
+
+    std::vector<int> output(test.size() + 2, -1);
+    assert(test.copy_to(output.begin() + 1, 3) == output.end() - 1);
+    assert(output.front() == -1 && output.back() == -1);
+    assert(std::equal(expected.begin(), expected.end(), output.begin() + 1));
+
+    // Exceptions thrown by tasks are passed on to the caller:
+    for (unsigned threads = 1; threads <= 8; threads *= 8)
+    {
+        ThrowingTask task(37);
+        int caught = -1;
+        try { rbst_parallel_for(1000, threads, task); } catch (int i) { caught = i; }
+        assert(caught == 37);
+    }
+}
+
+// Compares pairs by their first element only.
+struct FirstCompare
+{
+    bool operator() (const std::pair<int,int> &a, const std::pair<int,int> &b) const
+    {
+        return a.first < b.first;
+    }
+};
+
+// An RNG which cannot be constructed from a seed.
+struct UnseededRng
+{
+    UnseededRng() : state(1) { }
+    size_t operator()(size_t bound) { state = 69069*state + 1; return state%bound; }
+    size_t state;
+};
+
+// A value whose copy constructor and assignment throw after a given number
+// of copies.
+struct ThrowingValue
+{
+    static int live, copies_left;
+
+    ThrowingValue(int j) : i(j) { ++live; }
+    ThrowingValue(const ThrowingValue &v) : i(v.i)
+    {
+        if (copies_left >= 0 && copies_left-- == 0) throw 0;
+        ++live;
+    }
+    ~ThrowingValue() { --live; }
+
+    ThrowingValue &operator=(const ThrowingValue &v)
+    {
+        if (copies_left >= 0 && copies_left-- == 0) throw 0;
+        i = v.i;
+        return *this;
+    }
+
+    bool operator<(const ThrowingValue &v) const { return i < v.i; }
+
+    int i;
+};
+
+int ThrowingValue::live = 0;
+int ThrowingValue::copies_left = -1;
+
+// Tests bulk construction from unsorted values, serially and in parallel.
+static void test15()
+{
+    for (int threads = 1; threads <= 8; threads *= 8)
+    {
+        std::vector<int> values;
+        for (int i = 0; i < 200000; ++i) values.push_back(rand()%150000);
+        RbstSet<int> test;
+        test.assign(values.begin(), values.end(), threads);
+        assert(rbst_check_structure(&test.debug_tree()));
+        assert(rbst_check_values(test.debug_tree().root(), test.debug_tree().comp()));
+        std::set<int> reference(values.begin(), values.end());
+        assert(test.size() == reference.size());
+        assert(std::equal(reference.begin(), reference.end(), test.begin()));
+        // Average depth should be close to 2 ln N (about 23):
+        assert(rbst_total_depth(test.debug_tree().root()) < 30*test.size());
+    }
+
+    // Of equivalent values, the first is kept (like insert() does):
+    std::vector<std::pair<int,int> > pairs;
+    for (int i = 0; i < 100000; ++i) pairs.push_back(std::make_pair(rand()%1000, i));
+    RbstSet<std::pair<int,int>, FirstCompare> a(pairs.begin(), pairs.end()), b;
+    for (size_t i = 0; i < pairs.size(); ++i) b.insert(pairs[i]);
+    assert(a.size() == 1000 && b.size() == 1000);
+    assert(std::equal(a.begin(), a.end(), b.begin()));
+
+    // Weight-balanced sets are built perfectly balanced:
+    std::vector<int> values;
+    for (int i = 0; i < 1023; ++i) values.push_back(i*5%1023);
+    RbstSet<int, std::less<int>, std::allocator<int>, RbstWeightBalanced> c(values.begin(), values.end());
+    assert(c.size() == 1023);
+    check(c);
+    assert(rbst_check_weight_balance(c.debug_tree().root()));
+    assert(rbst_max_depth(c.debug_tree().root()) == 10);
+
+    // The range constructor builds serially, with the set's own RNG:
+    typedef RbstSet<int, std::less<int>, std::allocator<int>, UnseededRng> UnseededSet;
+    UnseededSet d(values.begin(), values.end());
+    assert(d.size() == 1023);
+    check(d);
+    RbstFilteredSet<UnseededSet> filtered(values.begin(), values.end());
+    RbstHashIndexedSet<UnseededSet> indexed(values.begin(), values.end());
+    assert(filtered == d && filtered.count(5) && !filtered.count(1023));
+    assert(indexed == d && indexed.index_of(5) == 5 && !indexed.count(1023));
+
+    // Nodes are freed if copying a value fails:
+    {
+        std::vector<ThrowingValue> input;
+        for (int i = 0; i < 1000; ++i) input.push_back(ThrowingValue(i*7%1000));
+        std::vector<ThrowingValue> sorted(input);
+        std::sort(sorted.begin(), sorted.end());
+        for (int copies = 0; copies < 3000; copies += 250)
+        {
+            RbstSet<ThrowingValue, std::less<ThrowingValue>, TestAllocator<int> > e;
+            int live = ThrowingValue::live;
+            ThrowingValue::copies_left = copies;
+            try { e.insert(sorted.begin(), sorted.end()); } catch (int) { }
+            try { e.assign(input.begin(), input.end(), 1); } catch (int) { }
+            ThrowingValue::copies_left = -1;
+            assert(ThrowingValue::live == live + (int)e.size());
+            e.clear();
+            assert(allocated.empty());
+        }
+    }
+    assert(ThrowingValue::live == 0);
+}
+
+// Checks rbst_sort() against std::stable_sort() on random values of type T.
+template<class T>
+static void test16_sort(T scale, T offset, unsigned threads)
+{
+    std::vector<T> a(100000 + rand()%1000);
+    for (size_t i = 0; i < a.size(); ++i) a[i] = (T)(rand()%1000*scale + offset);
+    std::vector<T> b = a;
+    rbst_sort(&a[0], &a[0] + a.size(), std::less<T>(), threads);
+    std::stable_sort(b.begin(), b.end());
+    assert(a == b);
+}
+
+// Tests radix sorting of integer and floating point keys.
+static void test16()
+{
+    for (unsigned threads = 1; threads <= 4; threads *= 4)
+    {
+        test16_sort<int>(1, -500, threads);
+        test16_sort<int>(2000000, 0, threads);
+        test16_sort<unsigned>(4000000, 7, threads);
+        test16_sort<long long>(10000000000000LL, -5000000000000000LL, threads);
+        test16_sort<unsigned char>(1, 3, threads);
+        test16_sort<short>(-3, 1, threads);
+        test16_sort<float>(0.25f, -100, threads);
+        test16_sort<double>(-1e300, 1e-300, threads);
+#ifdef __SIZEOF_INT128__
+        // Integers without a radix key type are sorted by comparison:
+        test16_sort<__int128>((__int128)1 << 100, -1, threads);
+#endif
+    }
+
+    // Negative and positive zero are equivalent, so the first one is kept:
+    double zeroes[4] = { 0.0, -1.0, -0.0, 1.0 };
+    RbstSet<double> a(&zeroes[0], &zeroes[4]), b(&zeroes[1], &zeroes[4]);
+    assert(a.size() == 3 && b.size() == 3);
+    assert(!signbit(*a.find(0.0)) && signbit(*b.find(0.0)));
+
+#ifdef __SIZEOF_INT128__
+    std::vector<__int128> wide;
+    for (int i = 0; i < 1000; ++i) wide.push_back((__int128)(i*7%1000) << 64);
+    RbstSet<__int128> c;
+    c.assign(wide.begin(), wide.end());
+    assert(c.size() == 1000 && c.begin()[500] == (__int128)500 << 64);
+#endif
+}
+
+// Tests batch lookup of elements by index.
+static void test17()
+{
+    RbstSet<int> test;
+    for (int i = 0; i < 1000; ++i) test.insert(rand()%5000);
+    const size_t n = test.size();
+
+    for (int k = 0; k < 100; ++k)
+    {
+        std::vector<size_t> indices;
+        for (int i = rand()%50; i > 0; --i) indices.push_back(rand()%(n + 1));
+        std::sort(indices.begin(), indices.end());
+        std::vector<RbstSet<int>::const_iterator> its;
+        test.at_many(indices.begin(), indices.end(), std::back_inserter(its));
+        assert(its.size() == indices.size());
+        for (size_t i = 0; i < indices.size(); ++i)
+            assert(its[i] == test.begin() + indices[i]);
+    }
+
+    std::vector<RbstSet<int>::const_iterator> q = test.quantiles(10);
+    assert(q.size() == 11 && q.front() == test.begin() && q.back() == test.end());
+    for (size_t i = 0; i <= 10; ++i) assert(q[i] - test.begin() == (ptrdiff_t)(i*n/10));
+    RbstSet<int> empty;
+    assert(empty.quantiles(4) == std::vector<RbstSet<int>::const_iterator>(5, empty.end()));
+}
+
+// Tests batch computation of ranks.
+static void test18()
+{
+    RbstSet<int> test;
+    for (int i = 0; i < 1000; ++i) test.insert(rand()%5000);
+
+    for (int k = 0; k < 100; ++k)
+    {
+        std::vector<int> keys;
+        for (int i = rand()%50; i > 0; --i) keys.push_back(rand()%5100 - 50);
+        std::sort(keys.begin(), keys.end());
+        std::vector<size_t> ranks;
+        test.rank_many(keys.begin(), keys.end(), std::back_inserter(ranks));
+        assert(ranks.size() == keys.size());
+        for (size_t i = 0; i < keys.size(); ++i)
+            assert(ranks[i] == (size_t)(test.lower_bound(keys[i]) - test.begin()));
+    }
+
+    RbstSet<int> empty;
+    int keys[3] = { 1, 2, 2 };
+    size_t ranks[3] = { 1, 1, 1 };
+    empty.rank_many(&keys[0], &keys[3], &ranks[0]);
+    assert(ranks[0] == 0 && ranks[1] == 0 && ranks[2] == 0);
+}
+
+// Tests intersection and union cardinalities.
+static void test19()
+{
+    for (int k = 0; k < 100; ++k)
+    {
+        RbstSet<int> a, b;
+        int range = 1 + rand()%2000;
+        for (int i = rand()%1000; i > 0; --i) a.insert(rand()%range);
+        for (int i = rand()%(k < 50 ? 1000 : 20); i > 0; --i) b.insert(rand()%range + rand()%2*range/2);
+        std::vector<int> va = a.to_vector(), vb = b.to_vector(), common;
+        std::set_intersection( va.begin(), va.end(), vb.begin(), vb.end(),
+                               std::back_inserter(common) );
+        assert(intersection_size(a, b) == common.size());
+        assert(intersection_size(b, a) == common.size());
+        assert(union_size(a, b) == a.size() + b.size() - common.size());
+        assert(a.intersection_size(a) == a.size() && a.union_size(a) == a.size());
+        for (size_t i = 0; i < common.size(); ++i)
+            assert(a.count(common[i]) == 1 && b.count(common[i]) == 1);
+        assert(b.count(range*2) == 0);
+    }
+}
+
+// Tests subtree hashes and diffing of sets with hashed nodes.
+template<class Rng>
+static void test20_rng()
+{
+    typedef RbstSet< int, std::less<int>, std::allocator<int>, Rng,
+                     RbstHashedNode<int> > HashedSet;
+    typedef RbstHashedNode<int> Node;
+
+    // Replicas with different shapes: one built by insertion, one in bulk.
+    HashedSet a(std::less<int>(), std::allocator<int>(), Rng(1)), b;
+    std::vector<int> values;
+    for (int i = 0; i < 2000; ++i) values.push_back(rand()%3000);
+    for (size_t i = 0; i < values.size(); ++i) a.insert(values[i]);
+    b.assign(values.begin(), values.end(), 2);
+    assert(a == b && a.hash() == b.hash());
+    std::vector<int> only_a, only_b;
+    a.diff(b, std::back_inserter(only_a), std::back_inserter(only_b));
+    assert(only_a.empty() && only_b.empty());
+
+    for (int k = 0; k < 200; ++k)
+    {
+        // Change a few elements of either replica:
+        for (int i = rand()%4; i > 0; --i)
+        {
+            HashedSet &s = rand()%2 ? a : b;
+            int key = rand()%3000;
+            if (s.count(key)) s.erase(key); else s.insert(key);
+        }
+        check(a);
+        check(b);
+        assert(rbst_check_hashes(static_cast<const Node*>(a.debug_tree().root())));
+        assert(rbst_check_hashes(static_cast<const Node*>(b.debug_tree().root())));
+
+        std::vector<int> va = a.to_vector(), vb = b.to_vector(), ea, eb;
+        std::set_difference(va.begin(), va.end(), vb.begin(), vb.end(), std::back_inserter(ea));
+        std::set_difference(vb.begin(), vb.end(), va.begin(), va.end(), std::back_inserter(eb));
+        only_a.clear();
+        only_b.clear();
+        a.diff(b, std::back_inserter(only_a), std::back_inserter(only_b));
+        assert(only_a == ea && only_b == eb);
+        assert((a.hash() == b.hash()) == (a == b));
+    }
+
+    HashedSet empty, copy(a);
+    assert(copy.hash() == a.hash() && empty.hash() == 0);
+    only_a.clear();
+    only_b.clear();
+    empty.diff(a, std::back_inserter(only_a), std::back_inserter(only_b));
+    assert(only_a.empty() && only_b == a.to_vector());
+}
+
+static void test20()
+{
+    test20_rng<DefaultRng>();
+    test20_rng<RbstWeightBalanced>();
+}
+
+// Compares strings ignoring case.
+struct NoCaseCompare
+{
+    bool operator() (const std::string &a, const std::string &b) const
+    {
+        for (size_t i = 0; i < a.size() && i < b.size(); ++i)
+            if (tolower(a[i]) != tolower(b[i])) return tolower(a[i]) < tolower(b[i]);
+        return a.size() < b.size();
+    }
+};
+
+// Hashes strings ignoring case (FNV-1a), consistent with NoCaseCompare.
+struct NoCaseHash
+{
+    uint64_t operator() (const std::string &s) const
+    {
+        uint64_t h = 14695981039346656037ULL;
+        for (size_t i = 0; i < s.size(); ++i) h = (h ^ (uint64_t)tolower(s[i]))*1099511628211ULL;
+        return h;
+    }
+};
+
+// Tests sets with a counting filter in front.
+static void test21()
+{
+    RbstFilteredSet<RbstSet<int> > test;
+    std::set<int> ref;
+    for (int k = 0; k < 20000; ++k)
+    {
+        int key = rand()%4000;
+        switch (rand()%4)
+        {
+        case 0:
+        case 1:
+            assert(test.insert(key).second == ref.insert(key).second);
+            break;
+        case 2:
+            assert(test.erase(key) == ref.erase(key));
+            break;
+        case 3:
+            if (test.find(key) != test.end())
+            {
+                test.erase(test.find(key));
+                ref.erase(key);
+            }
+            break;
+        }
+        assert(test.count(key) == ref.count(key));
+        assert((test.find(key) != test.end()) == (ref.count(key) != 0));
+    }
+    check(test);
+    assert(get_contents(test.begin(), test.end()) == get_contents(ref.begin(), ref.end()));
+    for (std::set<int>::iterator it = ref.begin(); it != ref.end(); ++it)
+        assert(test.filter().may_contain(*it));
+
+    // Few absent keys should pass the filter:
+    size_t passed = 0;
+    for (int key = 4000; key < 14000; ++key) passed += test.filter().may_contain(key);
+    assert(passed < 1000);
+
+    std::vector<int> values(ref.begin(), ref.end());
+    RbstFilteredSet<RbstSet<int> > copy(test), bulk(values.begin(), values.end());
+    copy.erase(copy.begin(), copy.end());
+    assert(copy.empty() && copy.count(values[0]) == 0);
+    assert(bulk == test && bulk.count(values[0]) == 1 && bulk.count(-1) == 0);
+    bulk.swap(copy);
+    assert(bulk.empty() && copy.count(values[0]) == 1);
+    copy.clear();
+    assert(copy.count(values[0]) == 0);
+
+    // With a case-insensitive comparator, the filter hashes keys ignoring case:
+    RbstFilteredSet< RbstSet<std::string, NoCaseCompare>,
+                     RbstCountingFilter<std::string, NoCaseHash> > words;
+    const char *const names[] = { "apple", "Banana", "CHERRY", "date" };
+    for (int i = 0; i < 1000; ++i)
+        words.insert(names[i%4] + std::string(i/4%10 + 1, 'x'));
+    assert(words.size() == 40);
+    assert(words.count("APPLEx") == 1 && words.count("banANAxxx") == 1);
+    assert(words.find("Cherryxxxxxxxxxx") != words.end() && *words.find("DATEX") == "datex");
+    assert(words.erase("ApPlExX") == 1 && words.count("applexx") == 0 && words.size() == 39);
+}
+
+// Tests sets with a hash index.
+static void test22()
+{
+    RbstHashIndexedSet<RbstSet<int> > test;
+    std::set<int> ref;
+    for (int k = 0; k < 20000; ++k)
+    {
+        int key = rand()%2000;
+        switch (rand()%4)
+        {
+        case 0:
+        case 1:
+            assert(test.insert(key).second == ref.insert(key).second);
+            break;
+        case 2:
+            assert(test.erase(key) == ref.erase(key));
+            break;
+        case 3:
+            if (test.find(key) != test.end())
+            {
+                test.erase(test.find(key));
+                ref.erase(key);
+            }
+            break;
+        }
+        assert(test.count(key) == ref.count(key));
+        assert(test.find(key) == test.lower_bound(key) || !ref.count(key));
+        assert(test.index_of(key) == (ref.count(key) ? (size_t)std::distance(ref.begin(), ref.find(key)) : test.size()));
+    }
+    check(test);
+    assert(get_contents(test.begin(), test.end()) == get_contents(ref.begin(), ref.end()));
+
+    // Copies get their own index:
+    RbstHashIndexedSet<RbstSet<int> > copy(test), other;
+    other = test;
+    test.clear();
+    assert(test.count(*copy.begin()) == 0);
+    for (std::set<int>::iterator it = ref.begin(); it != ref.end(); ++it)
+    {
+        assert(*copy.find(*it) == *it && *other.find(*it) == *it);
+        assert(copy.find(*it) != other.find(*it));
+    }
+    copy.swap(test);
+    assert(copy.empty() && test.size() == ref.size() && test.count(*ref.begin()));
+    copy.insert(ref.begin(), ref.end());
+    assert(copy == test && copy.index_of(*ref.rbegin()) == ref.size() - 1);
+}
+
+// Tests erasing ranges of elements.
+template<class Rng>
+static void test23_erase_range(bool weight_balanced)
+{
+    for (int k = 0; k < 200; ++k)
+    {
+        RbstSet<int, std::less<int>, std::allocator<int>, Rng> test;
+        std::vector<int> ref;
+        for (int i = rand()%500; i > 0; --i) test.insert(rand()%1000);
+        ref.assign(test.begin(), test.end());
+        size_t lo = rand()%(ref.size() + 1), hi = lo + rand()%(ref.size() - lo + 1);
+        test.erase(test.begin() + lo, test.begin() + hi);
+        ref.erase(ref.begin() + lo, ref.begin() + hi);
+        check(test);
+        if (weight_balanced) assert(rbst_check_weight_balance(test.debug_tree().root()));
+        assert(get_contents(test.begin(), test.end()) == ref);
+    }
+}
+
+// Tests bounded sets, and erasing ranges.
+static void test23()
+{
+    test23_erase_range<DefaultRng>(false);
+    test23_erase_range<RbstWeightBalanced>(true);
+
+    const size_t capacity = 100;
+    RbstBoundedSet<RbstSet<int> > test(capacity);
+    std::set<int> ref;
+    for (int k = 0; k < 10000; ++k)
+    {
+        int key = rand()%1000;
+        if (rand()%10 == 0)
+        {
+            assert(test.erase(key) == ref.erase(key));
+        }
+        else
+        {
+            std::pair<RbstSet<int>::iterator, bool> res = test.insert(key);
+            bool inserted = ref.insert(key).second;
+            if (ref.size() > capacity)
+            {
+                std::set<int>::iterator last = --ref.end();
+                inserted = inserted && *last != key;
+                ref.erase(last);
+            }
+            assert(res.second == inserted);
+            assert(res.second || (res.first != test.end()) == (ref.count(key) == 1));
+            assert(res.first == test.end() || *res.first == key);
+        }
+        assert(test.size() == ref.size());
+        assert(test.max() == (ref.empty() ? test.end() : test.find(*ref.rbegin())));
+    }
+    check(test);
+    assert(get_contents(test.begin(), test.end()) == get_contents(ref.begin(), ref.end()));
+
+    // Batch admission:
+    std::vector<int> batch;
+    for (int i = 0; i < 1000; ++i) batch.push_back(rand()%2000 - 1000);
+    test.insert(batch.begin(), batch.end());
+    ref.insert(batch.begin(), batch.end());
+    while (ref.size() > capacity) ref.erase(--ref.end());
+    check(test);
+    assert(get_contents(test.begin(), test.end()) == get_contents(ref.begin(), ref.end()));
+    assert(*test.max() == *ref.rbegin());
+
+    RbstBoundedSet<RbstSet<int> > copy(test), small(3, batch.begin(), batch.end());
+    assert(copy == test && *copy.max() == *test.max() && copy.max() != test.max());
+    std::sort(batch.begin(), batch.end());
+    batch.erase(std::unique(batch.begin(), batch.end()), batch.end());
+    assert(small.size() == 3 && *small.begin() == batch[0] && *small.max() == batch[2]);
+    small.swap(copy);
+    assert(small.size() == capacity && copy.size() == 3 && *copy.max() == batch[2]);
+    small.erase(small.begin() + 10, small.end());
+    assert(small.size() == 10 && small.max() == small.begin() + 9);
+    small.clear();
+    assert(small.max() == small.end() && small.insert(1).second && *small.max() == 1);
+}
+
+// Tests sets of integers stored as runs.
+static void test24()
+{
+    RbstRangeSet<int> test;
+    std::set<int> ref;
+    for (int k = 0; k < 5000; ++k)
+    {
+        int lo = rand()%1000 - 500, hi = lo + (rand()%4 ? 0 : rand()%50);
+        if (rand()%3)
+        {
+            size_t added = 0;
+            for (int x = lo; x <= hi; ++x) added += ref.insert(x).second;
+            assert(test.insert(lo, hi) == added);
+        }
+        else
+        {
+            size_t removed = 0;
+            for (int x = lo; x <= hi; ++x) removed += ref.erase(x);
+            assert(test.erase(lo, hi) == removed);
+        }
+        assert(test.size() == ref.size() && test.empty() == ref.empty());
+
+        // Runs must be maximal:
+        std::vector<int> contents;
+        int last = 0;
+        RbstSetRange<std::pair<int,int> > runs = test.runs();
+        for ( RbstSetRangeIterator<std::pair<int,int> > it = runs.begin();
+              it != runs.end(); ++it )
+        {
+            assert(it->first <= it->second);
+            assert(contents.empty() || it->first > last + 1);
+            for (int x = it->first; x <= it->second; ++x) contents.push_back(x);
+            last = it->second;
+        }
+        assert(contents == std::vector<int>(ref.begin(), ref.end()));
+        assert(runs.size() == test.run_count());
+    }
+
+    std::vector<int> values(ref.begin(), ref.end());
+    for (size_t i = 0; i < values.size(); ++i) assert(test.at(i) == values[i]);
+    for (int x = -600; x < 600; ++x)
+    {
+        assert(test.count(x) == ref.count(x));
+        assert(test.rank(x) == (size_t)std::distance(ref.begin(), ref.lower_bound(x)));
+    }
+
+    RbstRangeSet<int> copy(test), other;
+    assert(copy.size() == test.size() && copy.run_count() == test.run_count());
+    copy.insert(-1000, 1000);
+    assert(copy.size() == 2001 && copy.run_count() == 1 && copy.rank(1000) == 2000);
+    copy.erase(0);
+    assert(copy.size() == 2000 && copy.run_count() == 2 && copy.at(1000) == 1);
+    assert(copy.insert(5, 4) == 0 && copy.erase(500, -500) == 0 && copy.size() == 2000);
+    other.swap(copy);
+    assert(copy.empty() && other.size() == 2000);
+    other.clear();
+    assert(other.empty() && other.run_count() == 0);
+
+    // Extreme values:
+    RbstRangeSet<unsigned char> bytes;
+    assert(bytes.insert(0, 255) == 256 && bytes.run_count() == 1);
+    assert(bytes.erase(0) == 1 && bytes.erase(255) == 1 && bytes.size() == 254);
+    assert(bytes.insert(255) && bytes.insert(0) && bytes.run_count() == 1);
+}
+
+// Tests multisets that store a count per distinct key.
+static void test25()
+{
+    RbstCountedMultiset<int> test;
+    std::multiset<int> ref;
+    for (int k = 0; k < 5000; ++k)
+    {
+        int key = rand()%200 - 100;
+        size_t n = rand()%5;
+        if (rand()%3)
+        {
+            for (size_t i = 0; i < n; ++i) ref.insert(key);
+            assert(test.insert(key, n) == ref.count(key));
+        }
+        else
+        {
+            size_t removed = std::min(n, ref.count(key));
+            for (size_t i = 0; i < removed; ++i) ref.erase(ref.find(key));
+            assert(test.erase(key, n) == removed);
+        }
+        assert(test.size() == ref.size() && test.empty() == ref.empty());
+        assert(test.count(key) == ref.count(key));
+    }
+
+    std::vector<int> values(ref.begin(), ref.end());
+    for (size_t i = 0; i < values.size(); ++i) assert(test.at(i) == values[i]);
+    for (int key = -110; key < 110; ++key)
+    {
+        assert(test.count(key) == ref.count(key));
+        assert(test.rank(key) == (size_t)std::distance(ref.begin(), ref.lower_bound(key)));
+    }
+
+    // Each distinct key has a single entry with a positive count:
+    size_t distinct = 0, total = 0;
+    RbstSetRange<std::pair<int,size_t> > entries = test.entries();
+    for ( RbstSetRangeIterator<std::pair<int,size_t> > it = entries.begin();
+          it != entries.end(); ++it )
+    {
+        assert(it->second > 0 && it->second == ref.count(it->first));
+        ++distinct;
+        total += it->second;
+    }
+    assert(distinct == test.distinct_size() && total == test.size());
+
+    RbstCountedMultiset<int> copy(test), other;
+    size_t n = copy.count(0);
+    assert(copy.insert(0, 1000000) == n + 1000000 && copy.size() == test.size() + 1000000);
+    assert(copy.at(copy.rank(0) + 999999) == 0 && copy.rank(1) == copy.rank(0) + n + 1000000);
+    assert(copy.erase(0) == n + 1000000 && copy.count(0) == 0 && copy.size() == test.size() - n);
+    assert(copy.erase(0) == 0 && copy.erase(0, 0) == 0 && copy.insert(0, 0) == 0);
+    other.swap(copy);
+    assert(copy.empty() && other.size() == test.size() - n);
+    other.clear();
+    assert(other.empty() && other.distinct_size() == 0);
+
+    // A different order:
+    RbstCountedMultiset<std::string, std::greater<std::string> > words;
+    words.insert("a", 2);
+    words.insert("c");
+    words.insert("b", 3);
+    assert(words.at(0) == "c" && words.at(1) == "b" && words.at(3) == "b" && words.at(4) == "a");
+    assert(words.rank("a") == 4 && words.rank("b") == 1);
+}
+
+// Tests replacing elements, which must reuse their nodes.
+template<class Rng>
+static void test26_rng(bool weight_balanced)
+{
+    typedef RbstHashedNode<int> Node;
+    typedef RbstSet<int, std::less<int>, TestAllocator<int>, Rng, Node> HashedSet;
+    {
+        HashedSet test;
+        std::set<int> ref;
+        for (int i = 0; i < 500; ++i)
+        {
+            int value = rand()%1000;
+            assert(test.insert(value).second == ref.insert(value).second);
+        }
+        assert(allocated.size() == ref.size());
+        for (int k = 0; k < 2000; ++k)
+        {
+            size_t i = rand()%test.size();
+            typename HashedSet::iterator it = test.begin() + i;
+            int old_value = *it, value = rand()%2 ? old_value + rand()%3 - 1 : rand()%1000;
+            bool present = value != old_value && ref.count(value);
+            std::pair<typename HashedSet::iterator, bool> res = test.replace(it, value);
+            ref.erase(old_value);
+            ref.insert(value);
+            assert(res.second == !present && *res.first == value);
+            assert(res.second ? res.first == it : res.first != it);
+            assert(test.size() == ref.size() && allocated.size() == ref.size());
+            check(test);
+            if (weight_balanced) assert(rbst_check_weight_balance(test.debug_tree().root()));
+            assert(rbst_check_hashes(static_cast<const Node*>(test.debug_tree().root())));
+            assert(get_contents(test.begin(), test.end()) == std::vector<int>(ref.begin(), ref.end()));
+        }
+        HashedSet rebuilt;
+        rebuilt.assign(ref.begin(), ref.end());
+        assert(rebuilt.hash() == test.hash());
+    }
+    assert(allocated.empty());
+}
+
+static void test26()
+{
+    test26_rng<DefaultRng>(false);
+    test26_rng<RbstWeightBalanced>(true);
+
+    // The wrappers must keep their side structures in sync:
+    RbstHashIndexedSet<RbstSet<int> > indexed;
+    RbstFilteredSet<RbstSet<int> > filtered;
+    RbstBoundedSet<RbstSet<int> > bounded(100);
+    for (int i = 0; i < 100; ++i)
+    {
+        indexed.insert(2*i);
+        filtered.insert(2*i);
+        bounded.insert(2*i);
+    }
+    for (int i = 0; i < 100; ++i)
+    {
+        indexed.replace(indexed.find(2*i), 2*i + 1);
+        filtered.replace(filtered.find(2*i), 2*i + 1);
+        bounded.replace(bounded.find(2*i), 2*i + 1);
+    }
+    assert(indexed.replace(indexed.find(1), 3).first == indexed.find(3));
+    assert(filtered.replace(filtered.find(1), 3).first == filtered.find(3));
+    assert(bounded.replace(bounded.find(199), 1000).second && *bounded.max() == 1000);
+    for (int i = 1; i < 100; ++i)
+    {
+        assert(!indexed.count(2*i) && indexed.count(2*i + 1));
+        assert(!filtered.count(2*i) && filtered.count(2*i + 1));
+        assert(indexed.index_of(2*i + 1) == (size_t)i - 1);
+    }
+    assert(indexed.size() == 99 && filtered.size() == 99 && !indexed.count(1));
+
+    // If assigning the value fails, the element is erased and its node freed:
+    {
+        RbstSet<ThrowingValue, std::less<ThrowingValue>, TestAllocator<int> > values;
+        for (int i = 0; i < 100; ++i) values.insert(ThrowingValue(i));
+        ThrowingValue value(1000);
+        ThrowingValue::copies_left = 0;
+        bool caught = false;
+        try { values.replace(values.begin(), value); } catch (int) { caught = true; }
+        ThrowingValue::copies_left = -1;
+        assert(caught && values.size() == 99 && values.begin()->i == 1);
+        assert(allocated.size() == 99 && ThrowingValue::live == 100);
+        assert(rbst_check_structure(&values.debug_tree()));
+    }
+    assert(allocated.empty() && ThrowingValue::live == 0);
+}
+
+// Tests appending increasing values.
+template<class Rng>
+static void test27_rng(bool weight_balanced)
+{
+    typedef RbstHashedNode<int> Node;
+    RbstSet<int, std::less<int>, std::allocator<int>, Rng, Node> test;
+    std::set<int> ref;
+    int next = 0;
+    for (int k = 0; k < 300; ++k)
+    {
+        if (rand()%2)
+        {
+            // Mostly increasing values, some of them out of order:
+            int value = rand()%4 ? next + rand()%3 : rand()%(next + 1);
+            next = std::max(next, value + 1);
+            bool added = ref.insert(value).second;
+            assert(test.push_back(value).second == added);
+        }
+        else
+        {
+            std::vector<int> values;
+            for (int i = rand()%20; i > 0; --i) values.push_back(next += 1 + rand()%3);
+            if (!values.empty() && rand()%4 == 0) values[rand()%values.size()] -= 50;
+            if (rand()%8 == 0) std::reverse(values.begin(), values.end());
+            ref.insert(values.begin(), values.end());
+            test.append(values.begin(), values.end(), 1 + rand()%2);
+        }
+        check(test);
+        if (weight_balanced) assert(rbst_check_weight_balance(test.debug_tree().root()));
+        assert(rbst_check_hashes(static_cast<const Node*>(test.debug_tree().root())));
+        assert(get_contents(test.begin(), test.end()) == std::vector<int>(ref.begin(), ref.end()));
+    }
+}
+
+static void test27()
+{
+    test27_rng<DefaultRng>(false);
+    test27_rng<RbstWeightBalanced>(true);
+
+    // Appended trees must be balanced:
+    RbstSet<int> test;
+    for (int i = 0; i < 1000; ++i) test.push_back(i);
+    check(test);
+    std::vector<int> values;
+    for (int i = 1000; i < 2000; ++i) values.push_back(i);
+    test.append(values.begin(), values.end());
+    check(test);
+    assert(test.size() == 2000 && test.begin()[1234] == 1234);
+
+    // The wrappers must keep their side structures in sync:
+    RbstHashIndexedSet<RbstSet<int> > indexed;
+    RbstFilteredSet<RbstSet<int> > filtered;
+    RbstBoundedSet<RbstSet<int> > bounded(50);
+    indexed.append(values.begin(), values.begin() + 100);
+    filtered.append(values.begin(), values.begin() + 100);
+    bounded.append(values.begin(), values.begin() + 100);
+    assert(indexed.push_back(5).second && filtered.push_back(5).second);
+    assert(bounded.push_back(5).second && !bounded.push_back(1000000).second);
+    assert(bounded.size() == 50 && *bounded.max() == values[48]);
+    for (int i = 0; i < 100; ++i)
+    {
+        assert(indexed.count(values[i]) && filtered.count(values[i]));
+        assert(indexed.index_of(values[i]) == (size_t)i + 1);
+    }
+}
+
+// Tests querying versioned sets at earlier versions.
+static void test28()
+{
+    {
+        RbstVersionedSet<int, std::less<int>, TestAllocator<int> > test;
+        std::vector<std::set<int> > ref(1);
+        for (int k = 0; k < 3000; ++k)
+        {
+            int key = rand()%300;
+            if (rand()%2)
+                assert(test.insert(key) == ref.back().insert(key).second);
+            else
+                assert(test.erase(key) == ref.back().erase(key));
+            assert(test.size() == ref.back().size());
+            assert(allocated.size() == test.node_count());
+
+            if (rand()%20 == 0)
+            {
+                assert(test.commit() == ref.size() - 1);
+                ref.push_back(ref.back());
+            }
+            if (rand()%500 == 0)
+            {
+                size_t nodes = test.node_count();
+                test.collect(test.version() - rand()%(test.version() - test.oldest() + 1));
+                assert(test.node_count() <= nodes && allocated.size() == test.node_count());
+            }
+
+            // Query a random version that is still retained:
+            size_t version = test.oldest() + rand()%(test.version() - test.oldest() + 1);
+            const std::set<int> &state = ref[version];
+            assert(test.size(version) == state.size());
+            assert(test.count(key, version) == state.count(key));
+            assert(test.rank(key, version) == (size_t)std::distance(state.begin(), state.lower_bound(key)));
+            const int *found = test.find(key, version), *bound = test.lower_bound(key, version);
+            assert(state.count(key) ? found && *found == key : !found);
+            std::set<int>::const_iterator lo = state.lower_bound(key);
+            assert(lo != state.end() ? bound && *bound == *lo : !bound);
+            if (!state.empty())
+            {
+                size_t i = rand()%state.size();
+                std::set<int>::const_iterator it = state.begin();
+                std::advance(it, i);
+                assert(test.at(i, version) == *it);
+            }
+            if (k%100 == 0)
+            {
+                std::vector<int> contents;
+                test.copy_to(std::back_inserter(contents), version);
+                assert(contents == std::vector<int>(state.begin(), state.end()));
+            }
+        }
+
+        // Collecting all history leaves one node per key:
+        test.collect(test.version());
+        assert(test.node_count() == test.size() && test.oldest() == test.version());
+        std::vector<int> contents;
+        test.copy_to(std::back_inserter(contents));
+        assert(contents == std::vector<int>(ref.back().begin(), ref.back().end()));
+    }
+    assert(allocated.empty());
+
+    // Unshared nodes are modified in place:
+    RbstVersionedSet<int> test, other;
+    for (int i = 0; i < 100; ++i) test.insert(i);
+    assert(test.node_count() == 100 && test.erase(50) && test.node_count() == 99);
+    test.commit();
+    assert(test.insert(50) && test.node_count() > 100 && test.count(50) && !test.count(50, 0));
+    assert(*test.find(50) == 50 && !test.find(50, 0) && *test.lower_bound(50, 0) == 51);
+    test.commit();
+    test.collect(1);
+    assert(test.node_count() == 100 && test.oldest() == 1 && test.rank(50, 1) == 50);
+    other.swap(test);
+    assert(test.empty() && test.node_count() == 0 && other.size() == 100);
+    other.clear();
+    assert(other.empty() && other.node_count() == 0 && other.oldest() == other.version());
+}
+
+// Counts the points of `ref` in [x1, x2] x [y1, y2].
+static size_t test29_count( const std::set<std::pair<int,int> > &ref,
+                            int x1, int x2, int y1, int y2 )
+{
+    size_t res = 0;
+    for ( std::set<std::pair<int,int> >::const_iterator it = ref.begin();
+          it != ref.end(); ++it )
+    {
+        res += x1 <= it->first && it->first <= x2 && y1 <= it->second && it->second <= y2;
+    }
+    return res;
+}
+
+// Tests counting points in rectangles.
+static void test29()
+{
+    RbstRangeCounter<int, int> test;
+    std::set<std::pair<int,int> > ref;
+    for (int k = 0; k < 3000; ++k)
+    {
+        int x = rand()%100, y = rand()%50;
+        if (rand()%3)
+            assert(test.insert(x, y) == ref.insert(std::make_pair(x, y)).second);
+        else
+            assert(test.erase(x, y) == ref.erase(std::make_pair(x, y)));
+        assert(test.size() == ref.size() && test.count(x, y) == ref.count(std::make_pair(x, y)));
+
+        int x1 = rand()%110 - 5, x2 = x1 + rand()%50, y1 = rand()%60 - 5, y2 = y1 + rand()%30;
+        assert(test.count(x1, x2, y1, y2) == test29_count(ref, x1, x2, y1, y2));
+        assert(test.count_below(x1, x2, y2) == test29_count(ref, x1, x2, -1, y2));
+        assert(test.count(x2, x1 - 1, y1, y2) == 0 && test.count(x1, x2, y2, y1 - 1) == 0);
+    }
+    assert(test.count(0, 99, 0, 49) == ref.size());
+
+    // Bulk building, and copies:
+    std::vector<std::pair<int,int> > points;
+    for (int i = 0; i < 2000; ++i) points.push_back(std::make_pair(rand()%1000, rand()%1000));
+    RbstRangeCounter<int, int> built(points.begin(), points.end()), copy(built);
+    std::set<std::pair<int,int> > unique(points.begin(), points.end());
+    assert(built.size() == unique.size() && copy.size() == unique.size());
+    for (int k = 0; k < 200; ++k)
+    {
+        int x1 = rand()%1000, x2 = x1 + rand()%300, y1 = rand()%1000, y2 = y1 + rand()%300;
+        size_t expected = test29_count(unique, x1, x2, y1, y2);
+        assert(built.count(x1, x2, y1, y2) == expected && copy.count(x1, x2, y1, y2) == expected);
+    }
+    copy.clear();
+    assert(copy.empty() && copy.count_below(0, 1000, 1000) == 0);
+    copy.swap(built);
+    assert(built.empty() && copy.count(0, 999, 0, 999) == unique.size());
+
+    // If inserting a point fails before it is linked, the counts are restored:
+    {
+        RbstRangeCounter<int, ThrowingValue> points;
+        for (int i = 0; i < 100; ++i) points.insert(i, ThrowingValue(i*37%100));
+        for (int copies = 0; copies < 20; ++copies)
+        {
+            ThrowingValue::copies_left = copies;
+            bool caught = false;
+            try { points.insert(50, ThrowingValue(1000)); } catch (int) { caught = true; }
+            ThrowingValue::copies_left = -1;
+            assert(caught && points.size() == 100);
+            assert(points.count(0, 200, ThrowingValue(0), ThrowingValue(1000)) == 100);
+            assert(points.count(0, 200, ThrowingValue(1000), ThrowingValue(1000)) == 0);
+        }
+    }
+}
+
+// Tests comparing iterator positions by key.
+static void test30()
+{
+    RbstSet<std::string> test;
+    for (int i = 0; i < 500; ++i)
+    {
+        std::string key;
+        for (int j = 0; j < 3; ++j) key += (char)('a' + rand()%10);
+        test.insert(key);
+    }
+    RbstSet<std::string>::iterator_compare comp = test.iterator_comp();
+    std::vector<RbstSet<std::string>::iterator> its;
+    for (size_t i = 0; i <= test.size(); ++i) its.push_back(test.begin() + i);
+    for (int k = 0; k < 2000; ++k)
+    {
+        RbstSet<std::string>::iterator a = its[rand()%its.size()], b = its[rand()%its.size()];
+        assert(test.precedes(a, b) == (a < b) && comp(a, b) == (a < b));
+    }
+    assert(!test.precedes(test.end(), test.end()) && test.precedes(test.begin(), test.end()));
+
+    std::vector<RbstSet<std::string>::iterator> shuffled(its);
+    for (size_t i = shuffled.size(); i > 1; --i) std::swap(shuffled[i - 1], shuffled[rand()%i]);
+    std::sort(shuffled.begin(), shuffled.end(), comp);
+    assert(shuffled == its);
+}
+
+// Checks a rope against a reference string.
+template<class Rope>
+static void test31_check(Rope &test, const std::string &ref)
+{
+    const RbstTree<std::string, std::less<std::string> > &tree = test.debug_tree();
+    assert(rbst_check_structure(tree.root(), &tree));
+    assert(test.size() == ref.size() && test.substr(0) == ref);
+    size_t chunks = 0;
+    for (typename Rope::chunk_iterator it = test.chunk_begin(); it != test.chunk_end(); ++it, ++chunks)
+        assert(!it->empty() && it->size() <= test.chunk_size());
+    assert(chunks == test.chunk_count());
+    assert(test.line_count() == (size_t)std::count(ref.begin(), ref.end(), '\n') + 1);
+}
+
+// Tests ropes, with small chunks.
+static void test31()
+{
+    typedef RbstRope<TestAllocator<char> > rope_t;
+    {
+        rope_t test(8);
+        std::string ref;
+        const char letters[] = "abc\nde\nfghij";
+        for (int k = 0; k < 2000; ++k)
+        {
+            size_t offset = rand()%(ref.size() + 1);
+            if (rand()%3)
+            {
+                std::string data;
+                for (int n = rand()%(rand()%4 ? 5 : 40); n > 0; --n) data += letters[rand()%12];
+                test.insert(offset, data);
+                ref.insert(offset, data);
+            }
+            else
+            {
+                size_t n = rand()%(rand()%4 ? 5 : 40);
+                test.erase(offset, n);
+                ref.erase(offset, n);
+            }
+            if (k%50 == 0) test31_check(test, ref);
+            if (ref.empty()) continue;
+
+            size_t i = rand()%ref.size(), n = rand()%20, pos = i;
+            assert(test.at(i) == ref[i] && test.substr(i, n) == ref.substr(i, n));
+            rope_t::chunk_iterator it = test.find_chunk(pos);
+            assert(pos < it->size() && (*it)[pos] == ref[i]);
+
+            size_t line = test.line_of(i);
+            assert(line == (size_t)std::count(ref.begin(), ref.begin() + i, '\n'));
+            size_t start = test.line_start(line);
+            assert(start <= i && (start == 0 || ref[start - 1] == '\n'));
+            assert(ref.find('\n', start) >= i);
+        }
+        test31_check(test, ref);
+        assert(test.line_start(test.line_count() - 1) == ref.rfind('\n') + 1);
+
+        // Splitting and concatenation:
+        rope_t copy(test), rest(8);
+        size_t offset = ref.size()/3;
+        copy.split(offset, rest);
+        test31_check(copy, ref.substr(0, offset));
+        test31_check(rest, ref.substr(offset));
+        rest.insert(rest.size()/2, copy);
+        assert(copy.empty() && copy.chunk_count() == 0);
+        std::string joined = ref.substr(offset);
+        joined.insert(joined.size()/2, ref.substr(0, offset));
+        test31_check(rest, joined);
+        rest.append(rest);
+        test31_check(rest, joined + joined);
+        rest.erase(0);
+        test31_check(rest, "");
+        test31_check(test, ref);
+        test.clear();
+        test31_check(test, "");
+    }
+    assert(allocated.empty());
+
+    // Large inserts are built in chunks of nearly equal size:
+    RbstRope<> big(1000);
+    std::string data(100000, 'x');
+    for (size_t i = 0; i < data.size(); i += 100) data[i] = '\n';
+    big.append(data);
+    assert(big.chunk_count() == 100 && big.line_count() == 1001);
+    assert(big.line_start(500) == 49901 && big.line_of(49901) == 500);
+    big.insert(50000, "\n");
+    assert(big.line_start(501) == 50001 && big.line_of(50001) == 501);
+    big.erase(10, 99000);
+    assert(big.size() == 1001 && big.substr(0) == data.substr(0, 10) + data.substr(99009));
+}
+
+// Looks up keys in an RbstAdaptiveSet, from several threads at once.
+struct Test32Reader
+{
+    Test32Reader(const RbstAdaptiveSet<RbstSet<int> > &set, std::vector<int> &found)
+        : set(set), found(found) { }
+
+    void operator()(size_t t)
+    {
+        for (size_t i = 3000*t; i < 3000*(t + 1); ++i)
+        {
+            RbstSet<int>::const_iterator it = set.find((int)(i%1100) - 50);
+            found[i] = it != set.end();
+        }
+    }
+
+    const RbstAdaptiveSet<RbstSet<int> > &set;
+    std::vector<int> &found;
+};
+
+// Tests adaptive sets, through phases of reads and writes.
+static void test32()
+{
+    RbstAdaptiveSet<RbstSet<int> > test;
+    std::set<int> ref;
+    for (int phase = 0; phase < 20; ++phase)
+    {
+        // Writes drop the flat array, unless they change nothing:
+        bool flat = phase > 0, changed = false;
+        for (int k = rand()%50; k >= 0; --k)
+        {
+            int key = rand()%1000;
+            switch (rand()%4)
+            {
+            case 0: changed = test.erase(key) > 0; assert(changed == (ref.erase(key) > 0)); break;
+            case 1: changed = test.push_back(key).second; assert(changed == ref.insert(key).second); break;
+            default: changed = test.insert(key).second; assert(changed == ref.insert(key).second);
+            }
+            flat = flat && !changed;
+            assert(test.is_flat() == flat);
+        }
+        assert(test.size() == ref.size());
+        test.set_flat_ratio(phase%2 ? 0.5 : 2);
+
+        // Reads build it after a number of reads proportional to the size:
+        for (int k = 0; k < 3000; ++k)
+        {
+            int key = rand()%1100 - 50;
+            std::set<int>::iterator lo = ref.lower_bound(key), hi = ref.upper_bound(key);
+            assert(test.count(key) == ref.count(key));
+            assert(test.lower_bound(key) - test.begin() == std::distance(ref.begin(), lo));
+            assert(test.upper_bound(key) - test.begin() == std::distance(ref.begin(), hi));
+            RbstSet<int>::const_iterator it = test.find(key);
+            assert(it == test.end() ? lo == hi : *it == key);
+            assert(test.equal_range(key).second == test.upper_bound(key));
+        }
+        assert(test.is_flat());
+        RbstAdaptiveSet<RbstSet<int> > copy(test);
+        assert(!copy.is_flat() && copy.count(ref.empty() ? 0 : *ref.begin()) == !ref.empty());
+    }
+    // Concurrent reads, one of which builds the flat array:
+    test.insert(-1);
+    ref.insert(-1);
+    std::vector<int> found(4*3000);
+    Test32Reader reader(test, found);
+    rbst_parallel_for(4, 4, reader);
+    assert(test.is_flat());
+    for (size_t i = 0; i < found.size(); ++i)
+        assert(found[i] == (int)ref.count((int)(i%1100) - 50));
+
+    test.erase(test.begin(), test.begin() + test.size()/2);
+    assert(!test.is_flat() && test.size() == ref.size() - ref.size()/2);
+    test.clear();
+    assert(test.empty() && test.find(1) == test.end() && !test.is_flat());
+}
+
 int main()
 {
     test1();
@@ -534,6 +1898,29 @@ int main()
     test7();
     test8();
     test9();
+    test10();
+    test11();
+    test12();
+    test13();
+    test14();
+    test15();
+    test16();
+    test17();
+    test18();
+    test19();
+    test20();
+    test21();
+    test22();
+    test23();
+    test24();
+    test25();
+    test26();
+    test27();
+    test28();
+    test29();
+    test30();
+    test31();
+    test32();
 
     // .check if tests cover all implemented methods (tedious...)
     // see also TODO's in RbstSet (and add testcases for them)
@@ -0,0 +1,418 @@
+#ifndef RBST_VERSIONED_H_INCLUDED
+#define RBST_VERSIONED_H_INCLUDED
+
+#include "RbstSet.h"
+#include <assert.h>
+#include <stdint.h>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+/* An RbstVersionedSet is a set that can be queried as of earlier versions.
+   Modifications belong to the current version(), and commit() closes the
+   current version, so that it can no longer change, and starts the next one.
+   Queries take a version argument (which defaults to the current version)
+   and see the set as it was at the end of that version.
+
+   The set is a random binary search tree like RbstSet, but its nodes have no
+   parent pointers, so that versions can share them: a modification copies
+   the nodes on its search path (path copying) if they are shared with a
+   closed version, and modifies them in place otherwise.  Each closed version
+   therefore costs O(log N) expected nodes per modification made in it,
+   instead of a full copy of the set, and queries at any version take
+   O(log N) expected time, since every version is a complete tree.  Nodes
+   are reference counted, and collect() releases the versions before a
+   watermark, freeing the nodes that no retained version uses.
+
+   Rng must be a random number generator; the weight-balanced tag is not
+   supported.  Versioned sets cannot be copied (but they can be swapped). */
+template< class Key,
+          class Comparator = std::less<Key>,
+          class Allocator = std::allocator<Key>,
+          class Rng = DefaultRng >
+class RbstVersionedSet
+{
+public:
+    typedef Key key_type, value_type;
+    typedef Comparator key_compare;
+    typedef Allocator allocator_type;
+    typedef size_t size_type;
+    typedef uint64_t version_type;
+
+    explicit RbstVersionedSet( const Comparator &comp = Comparator(),
+                               const Allocator &alloc = Allocator(),
+                               const Rng &rng = Rng() )
+        : m_comp(comp), m_alloc(alloc), m_rng(rng), m_node_alloc(), m_root(NULL),
+          m_version(0), m_oldest(0), m_nodes(0) { }
+
+    ~RbstVersionedSet() { clear(); }
+
+    // Returns the current version, which the next modifications are part of.
+    version_type version() const { return m_version; }
+
+    // Returns the oldest version that can still be queried.
+    version_type oldest() const { return m_oldest; }
+
+    // Closes the current version, and returns it.
+    version_type commit()
+    {
+        m_versions.push_back(m_root);
+        acquire(m_root);
+        return m_version++;
+    }
+
+    // Returns the number of nodes used by all retained versions.
+    size_type node_count() const { return m_nodes; }
+
+    key_compare key_comp() const { return m_comp; }
+
+    // Returns the number of keys at `version`.
+    size_type size() const { return Node::size_of(m_root); }
+    size_type size(version_type version) const { return Node::size_of(root(version)); }
+
+    bool empty() const { return m_root == NULL; }
+
+    // Returns whether `key` is in the set at `version` (0 or 1).
+    size_type count(const Key &key) const { return find_node(m_root, key) != NULL; }
+    size_type count(const Key &key, version_type version) const
+    {
+        return find_node(root(version), key) != NULL;
+    }
+
+    // Returns the key equivalent to `key` at `version`, or NULL if none is.
+    const Key *find(const Key &key) const { return find(key, m_version); }
+    const Key *find(const Key &key, version_type version) const
+    {
+        const Node *node = find_node(root(version), key);
+        return node ? &node->value : NULL;
+    }
+
+    // Returns the first key not less than `key` at `version`, or NULL if
+    // there is none.
+    const Key *lower_bound(const Key &key) const { return lower_bound(key, m_version); }
+    const Key *lower_bound(const Key &key, version_type version) const
+    {
+        const Key *res = NULL;
+        for (const Node *node = root(version); node; )
+        {
+            if (m_comp(node->value, key))
+            {
+                node = node->right;
+            }
+            else
+            {
+                res = &node->value;
+                node = node->left;
+            }
+        }
+        return res;
+    }
+
+    // Returns the number of keys less than `key` at `version`.
+    size_type rank(const Key &key) const { return rank(key, m_version); }
+    size_type rank(const Key &key, version_type version) const
+    {
+        size_type res = 0;
+        for (const Node *node = root(version); node; )
+        {
+            if (m_comp(node->value, key))
+            {
+                res += Node::size_of(node->left) + 1;
+                node = node->right;
+            }
+            else
+            {
+                node = node->left;
+            }
+        }
+        return res;
+    }
+
+    // Returns the key at index `i` at `version`, which must be less than
+    // size(version).
+    const Key &at(size_type i) const { return at(i, m_version); }
+    const Key &at(size_type i, version_type version) const
+    {
+        const Node *node = root(version);
+        for (;;)
+        {
+            size_type left = Node::size_of(node->left);
+            if (i == left) return node->value;
+            if (i < left)
+            {
+                node = node->left;
+            }
+            else
+            {
+                i -= left + 1;
+                node = node->right;
+            }
+        }
+    }
+
+    // Copies the keys at `version` in order to `out`.
+    template<class OutputIterator>
+    OutputIterator copy_to(OutputIterator out) const { return copy_to(out, m_version); }
+    template<class OutputIterator>
+    OutputIterator copy_to(OutputIterator out, version_type version) const
+    {
+        return copy(root(version), out);
+    }
+
+    // Inserts `key` in the current version, and returns whether it was added.
+    bool insert(const Key &key)
+    {
+        if (find_node(m_root, key)) return false;
+        m_root = insert(m_root, create(key));
+        return true;
+    }
+
+    // Erases `key` in the current version, and returns whether it was removed.
+    size_type erase(const Key &key)
+    {
+        if (!find_node(m_root, key)) return 0;
+        m_root = erase(m_root, key);
+        return 1;
+    }
+
+    /* Discards the versions before `watermark` (which must not be after the
+       current version), so that they can no longer be queried, and frees the
+       nodes that are not used by later versions. */
+    void collect(version_type watermark)
+    {
+        assert(watermark <= m_version);
+        if (watermark <= m_oldest) return;
+        size_type n = (size_type)(watermark - m_oldest);
+        for (size_type i = 0; i < n; ++i) release(m_versions[i]);
+        m_versions.erase(m_versions.begin(), m_versions.begin() + n);
+        m_oldest = watermark;
+    }
+
+    // Erases all keys, and discards all history.  The version continues.
+    void clear()
+    {
+        for (size_type i = 0; i < m_versions.size(); ++i) release(m_versions[i]);
+        m_versions.clear();
+        release(m_root);
+        m_root = NULL;
+        m_oldest = m_version;
+    }
+
+    void swap(RbstVersionedSet &that)
+    {
+        std::swap(m_comp, that.m_comp);
+        std::swap(m_alloc, that.m_alloc);
+        std::swap(m_rng, that.m_rng);
+        std::swap(m_node_alloc, that.m_node_alloc);
+        std::swap(m_root, that.m_root);
+        m_versions.swap(that.m_versions);
+        std::swap(m_version, that.m_version);
+        std::swap(m_oldest, that.m_oldest);
+        std::swap(m_nodes, that.m_nodes);
+    }
+
+protected:
+    // A node, with the number of references to it from parents and versions.
+    struct Node
+    {
+        Node(const Key &value) : value(value), left(NULL), right(NULL), size(1), refs(1) { }
+
+        static size_type size_of(const Node *node) { return node ? node->size : 0; }
+
+        Key value;
+        Node *left, *right;
+        size_type size, refs;
+    };
+
+    typedef typename Allocator::template rebind<Node>::other node_allocator_type;
+
+    // Returns the root of the tree at `version`.
+    const Node *root(version_type version) const
+    {
+        assert(version >= m_oldest && version <= m_version);
+        return version == m_version ? m_root : m_versions[(size_type)(version - m_oldest)];
+    }
+
+    const Node *find_node(const Node *node, const Key &key) const
+    {
+        while (node)
+        {
+            if (m_comp(key, node->value))
+                node = node->left;
+            else
+            if (m_comp(node->value, key))
+                node = node->right;
+            else
+                break;
+        }
+        return node;
+    }
+
+    template<class OutputIterator>
+    static OutputIterator copy(const Node *node, OutputIterator out)
+    {
+        for (; node; node = node->right)
+        {
+            out = copy(node->left, out);
+            *out++ = node->value;
+        }
+        return out;
+    }
+
+    Node *create(const Key &key)
+    {
+        Node *node = m_node_alloc.allocate(1);
+        new (node) Node(key);
+        ++m_nodes;
+        return node;
+    }
+
+    void destroy(Node *node)
+    {
+        node->~Node();
+        m_node_alloc.deallocate(node, 1);
+        --m_nodes;
+    }
+
+    static void acquire(Node *node) { if (node) ++node->refs; }
+
+    // Drops a reference to `node`, and frees it (and its children) if unused.
+    void release(Node *node)
+    {
+        while (node && --node->refs == 0)
+        {
+            release(node->left);
+            Node *right = node->right;
+            destroy(node);
+            node = right;
+        }
+    }
+
+    /* Returns a node with the contents of `node` that can be modified in
+       place, in exchange for a reference to `node`: either `node` itself, if
+       this was its only reference, or a copy. */
+    Node *unshare(Node *node)
+    {
+        if (node->refs == 1) return node;
+        Node *copy = create(node->value);
+        copy->left  = node->left;
+        copy->right = node->right;
+        copy->size  = node->size;
+        acquire(copy->left);
+        acquire(copy->right);
+        --node->refs;
+        return copy;
+    }
+
+    static void update_size(Node *node)
+    {
+        node->size = 1 + Node::size_of(node->left) + Node::size_of(node->right);
+    }
+
+    // The following take over the references to their argument trees, and
+    // return references to the resulting trees.
+
+    // Splits the tree at `node` into the keys less than `key`, and the others.
+    void split(Node *node, const Key &key, Node *&lesser, Node *&greater)
+    {
+        if (!node)
+        {
+            lesser = greater = NULL;
+            return;
+        }
+        node = unshare(node);
+        if (m_comp(node->value, key))
+        {
+            split(node->right, key, node->right, greater);
+            lesser = node;
+        }
+        else
+        {
+            split(node->left, key, lesser, node->left);
+            greater = node;
+        }
+        update_size(node);
+    }
+
+    // Merges two trees, where the keys of `lesser` precede those of `greater`.
+    Node *join(Node *lesser, Node *greater)
+    {
+        if (!lesser) return greater;
+        if (!greater) return lesser;
+        if (m_rng(lesser->size + greater->size) < lesser->size)
+        {
+            lesser = unshare(lesser);
+            lesser->right = join(lesser->right, greater);
+            update_size(lesser);
+            return lesser;
+        }
+        greater = unshare(greater);
+        greater->left = join(lesser, greater->left);
+        update_size(greater);
+        return greater;
+    }
+
+    // Inserts the unshared leaf `leaf`, whose key is not in the tree yet.
+    Node *insert(Node *node, Node *leaf)
+    {
+        if (!node) return leaf;
+        if (m_rng(node->size + 1) == 0)
+        {
+            split(node, leaf->value, leaf->left, leaf->right);
+            update_size(leaf);
+            return leaf;
+        }
+        node = unshare(node);
+        if (m_comp(leaf->value, node->value))
+            node->left = insert(node->left, leaf);
+        else
+            node->right = insert(node->right, leaf);
+        ++node->size;
+        return node;
+    }
+
+    // Erases `key`, which must be in the tree.
+    Node *erase(Node *node, const Key &key)
+    {
+        if (!m_comp(key, node->value) && !m_comp(node->value, key))
+        {
+            Node *left = node->left, *right = node->right;
+            if (node->refs == 1)
+            {
+                destroy(node);
+            }
+            else
+            {
+                acquire(left);
+                acquire(right);
+                --node->refs;
+            }
+            return join(left, right);
+        }
+        node = unshare(node);
+        if (m_comp(key, node->value))
+            node->left = erase(node->left, key);
+        else
+            node->right = erase(node->right, key);
+        --node->size;
+        return node;
+    }
+
+    Comparator          m_comp;
+    Allocator           m_alloc;
+    Rng                 m_rng;
+    node_allocator_type m_node_alloc;
+    Node                *m_root;
+    std::vector<Node*>  m_versions;     // roots of versions m_oldest..m_version-1
+    version_type        m_version, m_oldest;
+    size_type           m_nodes;
+
+private:
+    // Versions share nodes through reference counts, so copying is not supported:
+    RbstVersionedSet(const RbstVersionedSet &);
+    RbstVersionedSet &operator=(const RbstVersionedSet &);
+};
+
+#endif  /* ndef RBST_VERSIONED_H_INCLUDED */
@@ -0,0 +1,97 @@
+#ifndef RBST_WEIGHTED_H_INCLUDED
+#define RBST_WEIGHTED_H_INCLUDED
+
+#include "RbstNode.h"
+#include <cstddef>
+
+/* An RbstWeightedNode extends an RbstValuedNode with the total weight of the
+   values in its subtree, where the weight of each value is given by the
+   `Weight` functor.  For example, a node may represent a run of integers, or
+   a key with a multiplicity, and then the weights allow indexing into the
+   expanded sequence of elements.  The node count in m_size is left alone,
+   since the tree algorithms balance the tree by node counts.
+
+   The weights are maintained by passing update_type to the RbstNode tree
+   algorithms (which RbstSet does for its node type), and by calling
+   update_path() after changing the value of a node. */
+template<class V, class Weight>
+class RbstWeightedNode : public RbstValuedNode<V>
+{
+public:
+    RbstWeightedNode( const V &value, RbstNode *left = NULL,
+                      RbstNode *right = NULL, RbstNode *parent = NULL )
+        : RbstValuedNode<V>(value, left, right, parent)
+    {
+        update_type()(this);
+    }
+
+    // Recomputes the subtree weight of a node from its value and children.
+    struct update_type
+    {
+        void operator()(RbstNode *node) const
+        {
+            RbstWeightedNode *n = static_cast<RbstWeightedNode*>(node);
+            n->m_weight = Weight()(n->value()) + weight(n->left()) + weight(n->right());
+        }
+    };
+
+    const RbstWeightedNode* left() const  { return static_cast<const RbstWeightedNode*>(this->m_left); }
+    const RbstWeightedNode* right() const { return static_cast<const RbstWeightedNode*>(this->m_right); }
+
+    // Returns the total weight of the subtree rooted at this node, or at
+    // `node` (0 if `node` is NULL).
+    size_t weight() const { return m_weight; }
+    static size_t weight(const RbstWeightedNode *node) { return node ? node->m_weight : 0; }
+
+    /* Returns the node containing the element at weighted index `index` in
+       the subtree rooted at `node`, and sets `index` to the offset of the
+       element within that node, or returns NULL if index >= weight(node). */
+    static const RbstWeightedNode *at_weight( const RbstWeightedNode *node,
+                                              size_t &index );
+
+    /* Returns the total weight of the nodes before this node in its tree,
+       i.e. the weighted index of its first element.  Like the update hook,
+       this assumes that the topmost node of the tree is a sentinel (which is
+       not an RbstWeightedNode), like RbstTree. */
+    size_t weight_index() const;
+
+protected:
+    size_t m_weight;
+};
+
+template<class V, class Weight>
+const RbstWeightedNode<V, Weight> *RbstWeightedNode<V, Weight>::at_weight(
+    const RbstWeightedNode *node, size_t &index )
+{
+    while (node)
+    {
+        size_t left = weight(node->left());
+        if (index < left)
+        {
+            node = node->left();
+            continue;
+        }
+        index -= left;
+        size_t own = Weight()(node->value());
+        if (index < own) return node;
+        index -= own;
+        node = node->right();
+    }
+    return NULL;
+}
+
+template<class V, class Weight>
+size_t RbstWeightedNode<V, Weight>::weight_index() const
+{
+    size_t index = weight(left());
+    for ( const RbstNode *node = this; node->parent() && node->parent()->parent();
+          node = node->parent() )
+    {
+        const RbstWeightedNode *parent = static_cast<const RbstWeightedNode*>(node->parent());
+        if (node == parent->right())
+            index += parent->m_weight - static_cast<const RbstWeightedNode*>(node)->m_weight;
+    }
+    return index;
+}
+
+#endif  /* ndef RBST_WEIGHTED_H_INCLUDED */